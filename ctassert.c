@@ -24,7 +24,7 @@
 int ctest_multi_calls;
 
 
-void test_assert_int()
+CTEST_COLD void test_assert_int()
 {
 	int a=4, b=3, c=4, z=0, n=-1;
 
@@ -81,7 +81,7 @@ void test_assert_int()
 }
 
 
-void test_assert_hex()
+CTEST_COLD void test_assert_hex()
 {
 	int a=4, b=3, c=4, z=0, n=-1;
 
@@ -138,7 +138,7 @@ void test_assert_hex()
 }
 
 
-void test_assert_ptr()
+CTEST_COLD void test_assert_ptr()
 {
 	int a, b;
 	int *ap = &a;
@@ -176,7 +176,7 @@ void test_assert_ptr()
 }
 
 
-void test_assert_float()
+CTEST_COLD void test_assert_float()
 {
 	float a=0.0004f, b=0.0003f, c=0.0004f;
 
@@ -222,7 +222,7 @@ void test_assert_float()
 }
 
 
-void test_assert_strings()
+CTEST_COLD void test_assert_strings()
 {
 	const char *a = "Bogozity";
 	const char *b = "Arclamp";
@@ -264,35 +264,35 @@ void test_assert_strings()
 }
 
 
-static int multi_int()
+CTEST_COLD static int multi_int()
 {
 	ctest_multi_calls += 1;
 	return ctest_multi_calls;
 }
 
 
-static void* multi_ptr()
+CTEST_COLD static void* multi_ptr()
 {
 	ctest_multi_calls += 1;
 	return ctest_multi_calls == 1 ? &ctest_multi_calls : NULL;
 }
 
 
-static void* multi_null()
+CTEST_COLD static void* multi_null()
 {
 	ctest_multi_calls += 1;
 	return ctest_multi_calls == 1 ? NULL : &ctest_multi_calls;
 }
 
 
-static const char *multi_str()
+CTEST_COLD static const char *multi_str()
 {
 	ctest_multi_calls += 1;
 	return ctest_multi_calls == 1 ? "yep" : "";
 }
 
 
-static const char* multi_str_empty()
+CTEST_COLD static const char* multi_str_empty()
 {
 	ctest_multi_calls += 1;
 	return ctest_multi_calls == 1 ? "" : "nope";
@@ -300,7 +300,7 @@ static const char* multi_str_empty()
 
 
 /* This test makes sure that assert macros only evaluate their arguments once. */
-void test_assert_args()
+CTEST_COLD void test_assert_args()
 {
 	int i;
 
@@ -340,14 +340,14 @@ void test_assert_args()
 }
 
 
-static int nested_assert()
+CTEST_COLD static int nested_assert()
 {
 	AssertEqual(12, 12);
 	return 42;
 }
 
 
-void run_ctassert_tests()
+CTEST_COLD void run_ctassert_tests()
 {
 	ctest_start("AssertInt") {
 		test_assert_int();
@@ -77,12 +77,8 @@
 #define AssertHexNonPositive(x) AssertHexOpToZero(x,<=);
 
 /* Pointers */
-#define AssertPtr(p)  do { void* pv = (p); \
-	ctest_assert_fmt(pv != (void*)0, __FILE__, __LINE__, "%s != NULL with %s==0x%lX!", #p, #p, pv); \
-	} while(0)
-#define AssertNull(p) do { void *pv = (p); \
-	ctest_assert_fmt(pv == (void*)0, __FILE__, __LINE__, "%s == NULL with %s==0x%lX!", #p, #p, pv); \
-	} while(0)
+#define AssertPtr(p) AssertSiteToZero(p,!=,void*,CTEST_SITE_PTR,ctest_internal_assert_ptr)
+#define AssertNull(p) AssertSiteToZero(p,==,void*,CTEST_SITE_PTR,ctest_internal_assert_ptr)
 #define AssertNonNull(p) AssertPtr(p)
 
 #define AssertPointer(p) AssertPtr(p)
@@ -137,23 +133,43 @@
 #define AssertStringLE(x,y) AssertStrLE(x,y)
 
 /* ensures a string is non-null but zero-length */
-#define AssertStrEmpty(p) do { char *pv = (void*)(p); \
-		if(!(pv)) { ctest_assert_fmt(0, __FILE__, __LINE__, #p" is empty with " #p " set to NULL"); } \
-		else if((pv)[0]) { ctest_assert_fmt(0, __FILE__, __LINE__, "%s is empty with %s set to \"%s\"", #p, #p, pv); } \
-		else ctest_assert_fmt(1, __FILE__, __LINE__, "%s is empty with %s[0]=0", #p, #p); \
-	} while(0)
+#define AssertStrEmpty(p) AssertEmptyOp(p,empty,ctest_xv && !ctest_xv[0])
 
 /* ensures a string is non-null and non-zero-length */
-#define AssertStrNonEmpty(p) do { char *pv = (void*)(p); \
-		if(!(pv)) { ctest_assert_fmt(0, __FILE__, __LINE__, "%s is nonempty with %s set to NULL", #p, #p); } \
-		else if(!(pv)[0]) { ctest_assert_fmt(0, __FILE__, __LINE__, "%s is nonempty with %s[0] set to 0", #p, #p); } \
-		else ctest_assert_fmt(1, __FILE__, __LINE__, "%s is empty with %s set to \"%s\"", #p, #p, pv); \
-	} while(0)
+#define AssertStrNonEmpty(p) AssertEmptyOp(p,nonempty,ctest_xv && ctest_xv[0])
 
 #define AssertStringEmpty(x) AssertStrEmpty(x)
 #define AssertStringNonEmpty(x) AssertStrNonEmpty(x)
 
 
+/* Batched asserts, for use in tight loops inside a ctest_batch block.
+ * They cost a compare and a branch when they pass; see ctest_batch. */
+#define BatchAssert(x) do { if(x) ctest_batch_passes++; \
+	else ctest_assert(0, __FILE__, __LINE__, #x); } while(0)
+#define BatchAssertEQ(x,y) BatchOp(x,==,y)
+#define BatchAssertNE(x,y) BatchOp(x,!=,y)
+#define BatchAssertGT(x,y) BatchOp(x,>,y)
+#define BatchAssertGE(x,y) BatchOp(x,>=,y)
+#define BatchAssertLT(x,y) BatchOp(x,<,y)
+#define BatchAssertLE(x,y) BatchOp(x,<=,y)
+#define BatchAssertZero(x) BatchOpToZero(x,==)
+#define BatchAssertNonzero(x) BatchOpToZero(x,!=)
+#define BatchAssertNonZero(x) BatchAssertNonzero(x)
+#define BatchAssertHexEQ(x,y) BatchHexOp(x,==,y)
+#define BatchAssertHexNE(x,y) BatchHexOp(x,!=,y)
+#define BatchAssertPtrEQ(x,y) BatchPtrOp(x,==,y)
+#define BatchAssertPtrNE(x,y) BatchPtrOp(x,!=,y)
+#define BatchAssertFloatEQ(x,y) BatchFloatOp(x,==,y)
+#define BatchAssertFloatNE(x,y) BatchFloatOp(x,!=,y)
+#define BatchAssertFloatGT(x,y) BatchFloatOp(x,>,y)
+#define BatchAssertFloatGE(x,y) BatchFloatOp(x,>=,y)
+#define BatchAssertFloatLT(x,y) BatchFloatOp(x,<,y)
+#define BatchAssertFloatLE(x,y) BatchFloatOp(x,<=,y)
+
+#define BatchAssertEqual(x,y) BatchAssertEQ(x,y)
+#define BatchAssertNotEqual(x,y) BatchAssertNE(x,y)
+
+
 /* Now let's spell some of those macros out... */
 
 /* I think that "Equal" looks better than "EQ". */
@@ -235,16 +251,63 @@
  */
 
 /* If the expression returns false, it is printed in the failure message. */
-#define Assert(x) \
-	ctest_assert((x), __FILE__, __LINE__, #x)
+#define Assert(x) do { int ctest_ok = !!(x); \
+	if(CTEST_LIKELY(ctest_ok & ctest_fast_asserts)) ctest_batch_passes++; \
+	else ctest_assert(ctest_ok, __FILE__, __LINE__, #x); \
+	} while(0)
 
-#define AssertExpType(x,op,y,type,fmt) do { type xv = (x); type yv = (y); \
-	ctest_assert_fmt(xv op yv, __FILE__, __LINE__, "%s %s %s with %s="fmt" and %s="fmt, #x, #op, #y, #x, xv, #y, yv); \
+/* A passing assert costs a compare and a branch.  A failing one is a call
+ * to one of the cold ctest_internal_assert routines with a CTEST_SITE
+ * string that describes it.  Nothing else about the assert ends up in
+ * the caller's code. */
+#define AssertSiteType(x,op,y,type,format,fail) do { type ctest_xv = (x); type ctest_yv = (y); \
+	if(CTEST_LIKELY((ctest_xv op ctest_yv) & ctest_fast_asserts)) ctest_batch_passes++; \
+	else fail(__FILE__, CTEST_SITE(format, #x, #op, #y), ctest_xv op ctest_yv, ctest_xv, ctest_yv); \
 	} while(0)
 /* The failure "x==0 failed because x==1 and 0==0" s too wordy so we'll */
 /* special-case checking against 0: "x==0 failed because x==1" */
-#define AssertExpToZero(x,op,type,fmt) do { type xv = (type)(x); \
-	ctest_assert_fmt(xv op 0, __FILE__, __LINE__, "%s %s 0 with %s="fmt, #x, #op, #x, xv); \
+#define AssertSiteToZero(x,op,type,format,fail) do { type ctest_xv = (type)(x); \
+	if(CTEST_LIKELY((ctest_xv op 0) & ctest_fast_asserts)) ctest_batch_passes++; \
+	else fail(__FILE__, CTEST_SITE(format, #x, #op, ""), ctest_xv op 0, ctest_xv, 0); \
+	} while(0)
+#define AssertStrOp(x,opn,op,y) do { const char *ctest_xv = (const char*)(x); const char *ctest_yv = (const char*)(y); \
+	if(CTEST_LIKELY((strcmp(ctest_xv,ctest_yv) op 0) & ctest_fast_asserts)) ctest_batch_passes++; \
+	else ctest_internal_assert_str(__FILE__, CTEST_SITE(CTEST_SITE_STR, #x, #opn, #y), strcmp(ctest_xv,ctest_yv) op 0, ctest_xv, ctest_yv); \
+	} while(0)
+#define AssertEmptyOp(p,opn,ok) do { const char *ctest_xv = (const char*)(p); \
+	if(CTEST_LIKELY((ok) & ctest_fast_asserts)) ctest_batch_passes++; \
+	else ctest_internal_assert_empty(__FILE__, CTEST_SITE(CTEST_SITE_STR, #p, #opn, ""), ctest_xv); \
+	} while(0)
+
+/* Batched versions don't check ctest_fast_asserts, see ctest_batch. */
+#define BatchSiteType(x,op,y,type,format,fail) do { type ctest_xv = (x); type ctest_yv = (y); \
+	if(CTEST_LIKELY(ctest_xv op ctest_yv)) ctest_batch_passes++; \
+	else fail(__FILE__, CTEST_SITE(format, #x, #op, #y), 0, ctest_xv, ctest_yv); \
+	} while(0)
+#define BatchSiteToZero(x,op,type,format,fail) do { type ctest_xv = (type)(x); \
+	if(CTEST_LIKELY(ctest_xv op 0)) ctest_batch_passes++; \
+	else fail(__FILE__, CTEST_SITE(format, #x, #op, ""), 0, ctest_xv, 0); \
+	} while(0)
+
+
+/* The asserts used to be expanded inline into a call to ctest_assert_fmt
+ * with the whole message as arguments.  Integer asserts still are when
+ * CTEST_LONG_LONG_ASSERTS is defined, since ctest.c doesn't use long
+ * long, and all of the numeric ones are when CTEST_INLINE_ASSERTS is
+ * defined ("make assert-size" uses it to measure the difference). */
+#define AssertExpType(x,op,y,type,fmt) do { type ctest_xv = (x); type ctest_yv = (y); \
+	ctest_assert_fmt(ctest_xv op ctest_yv, __FILE__, __LINE__, "%s %s %s with %s="fmt" and %s="fmt, #x, #op, #y, #x, ctest_xv, #y, ctest_yv); \
+	} while(0)
+#define AssertExpToZero(x,op,type,fmt) do { type ctest_xv = (type)(x); \
+	ctest_assert_fmt(ctest_xv op 0, __FILE__, __LINE__, "%s %s 0 with %s="fmt, #x, #op, #x, ctest_xv); \
+	} while(0)
+#define BatchExpType(x,op,y,type,fmt) do { type ctest_xv = (x); type ctest_yv = (y); \
+	if(ctest_xv op ctest_yv) ctest_batch_passes++; \
+	else ctest_assert_fmt(0, __FILE__, __LINE__, "%s %s %s with %s="fmt" and %s="fmt, #x, #op, #y, #x, ctest_xv, #y, ctest_yv); \
+	} while(0)
+#define BatchExpToZero(x,op,type,fmt) do { type ctest_xv = (type)(x); \
+	if(ctest_xv op 0) ctest_batch_passes++; \
+	else ctest_assert_fmt(0, __FILE__, __LINE__, "%s %s 0 with %s="fmt, #x, #op, #x, ctest_xv); \
 	} while(0)
 
 
@@ -261,15 +324,35 @@
 #define CTiFMT "%l"
 #endif
 
+#if defined(CTEST_LONG_LONG_ASSERTS) || defined(CTEST_INLINE_ASSERTS)
 #define AssertOp(x,op,y) AssertExpType(x,op,y,CTiLONG,CTiFMT"d")
 #define AssertHexOp(x,op,y) AssertExpType(x,op,y,CTiLONG,"0x"CTiFMT"X")
 #define AssertOpToZero(x,op) AssertExpToZero(x,op,CTiLONG,CTiFMT"d")
 #define AssertHexOpToZero(x,op) AssertExpToZero(x,op,CTiLONG,"0x"CTiFMT"X")
+#define BatchOp(x,op,y) BatchExpType(x,op,y,CTiLONG,CTiFMT"d")
+#define BatchHexOp(x,op,y) BatchExpType(x,op,y,CTiLONG,"0x"CTiFMT"X")
+#define BatchOpToZero(x,op) BatchExpToZero(x,op,CTiLONG,CTiFMT"d")
+#else
+#define AssertOp(x,op,y) AssertSiteType(x,op,y,long,CTEST_SITE_DEC,ctest_internal_assert_long)
+#define AssertHexOp(x,op,y) AssertSiteType(x,op,y,long,CTEST_SITE_HEX,ctest_internal_assert_long)
+#define AssertOpToZero(x,op) AssertSiteToZero(x,op,long,CTEST_SITE_DEC,ctest_internal_assert_long)
+#define AssertHexOpToZero(x,op) AssertSiteToZero(x,op,long,CTEST_SITE_HEX,ctest_internal_assert_long)
+#define BatchOp(x,op,y) BatchSiteType(x,op,y,long,CTEST_SITE_DEC,ctest_internal_assert_long)
+#define BatchHexOp(x,op,y) BatchSiteType(x,op,y,long,CTEST_SITE_HEX,ctest_internal_assert_long)
+#define BatchOpToZero(x,op) BatchSiteToZero(x,op,long,CTEST_SITE_DEC,ctest_internal_assert_long)
+#endif
+
+#ifdef CTEST_INLINE_ASSERTS
 #define AssertPtrOp(x,op,y) AssertExpType(x,op,y,void*,"0x%lX")		/* can't use %p because some libc print "0x" first and some don't */
 #define AssertFloatOp(x,op,y) AssertExpType(x,op,y,double,"%lf")
-#define AssertStrOp(x,opn,op,y) do { char *xv = (void*)(x); char *yv = (void*)(y); \
-	ctest_assert_fmt(strcmp(xv,yv) op 0, __FILE__, __LINE__, "%s %s %s with %s=\"%s\" and %s=\"%s\"", #x, #opn, #y, #x, xv, #y, yv); \
-	} while(0)
+#define BatchPtrOp(x,op,y) BatchExpType(x,op,y,void*,"0x%lX")
+#define BatchFloatOp(x,op,y) BatchExpType(x,op,y,double,"%lf")
+#else
+#define AssertPtrOp(x,op,y) AssertSiteType(x,op,y,void*,CTEST_SITE_PTR,ctest_internal_assert_ptr)
+#define AssertFloatOp(x,op,y) AssertSiteType(x,op,y,double,CTEST_SITE_FLOAT,ctest_internal_assert_double)
+#define BatchPtrOp(x,op,y) BatchSiteType(x,op,y,void*,CTEST_SITE_PTR,ctest_internal_assert_ptr)
+#define BatchFloatOp(x,op,y) BatchSiteType(x,op,y,double,CTEST_SITE_FLOAT,ctest_internal_assert_double)
+#endif
 
 
 /* If you want to run the unit tests for these asserts before using
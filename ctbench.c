@@ -0,0 +1,905 @@
+/* ctbench.c
+ * The ctest contributors
+ * 19 Oct 2026
+ *
+ * Benchmarks that can fail a test.  See ctbench.h.
+ *
+ * Copyright (C) 2026 The ctest contributors
+ * This file is released under the MIT License.
+ * See http://www.opensource.org/licenses/mit-license.php
+ */
+
+/* Stress runs use POSIX threads when they're available.
+ * This must come before any includes. */
+#if defined(__unix__) || defined(__APPLE__)
+#define CTEST_THREADS 1
+#define _POSIX_C_SOURCE 200112L
+#endif
+/* Instructions are counted with Linux's perf events, which need syscall(). */
+#ifdef __linux__
+#define CTEST_PERF 1
+#define _DEFAULT_SOURCE 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef CTEST_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef CTEST_PERF
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "ctbench.h"
+
+
+/*
+ *  Statistics
+ */
+
+/** Lanczos approximation of ln(gamma(x)) for x > 0. */
+
+CTEST_SECTION static double log_gamma(double x)
+{
+	static const double coef[6] = {
+		76.18009172947146, -86.50532032941677, 24.01409824083091,
+		-1.231739572450155, 0.1208650973866179e-2, -0.5395239384953e-5
+	};
+	double y = x, tmp, ser = 1.000000000190015;
+	int i;
+
+	tmp = x + 5.5;
+	tmp -= (x + 0.5) * log(tmp);
+	for(i=0; i<6; i++) {
+		ser += coef[i] / ++y;
+	}
+	return -tmp + log(2.5066282746310005 * ser / x);
+}
+
+
+/** Continued fraction for the incomplete beta function. */
+
+CTEST_SECTION static double beta_fraction(double a, double b, double x)
+{
+	double c = 1, d, h, aa, del;
+	int m, m2;
+
+	d = 1 - (a+b) * x / (a+1);
+	if(fabs(d) < 1e-300) d = 1e-300;
+	d = 1/d;
+	h = d;
+
+	for(m=1; m<=200; m++) {
+		m2 = 2*m;
+		aa = m * (b-m) * x / ((a-1+m2) * (a+m2));
+		d = 1 + aa*d;
+		if(fabs(d) < 1e-300) d = 1e-300;
+		c = 1 + aa/c;
+		if(fabs(c) < 1e-300) c = 1e-300;
+		d = 1/d;
+		h *= d*c;
+
+		aa = -(a+m) * (a+b+m) * x / ((a+m2) * (a+1+m2));
+		d = 1 + aa*d;
+		if(fabs(d) < 1e-300) d = 1e-300;
+		c = 1 + aa/c;
+		if(fabs(c) < 1e-300) c = 1e-300;
+		d = 1/d;
+		del = d*c;
+		h *= del;
+		if(fabs(del - 1) < 1e-12) {
+			break;
+		}
+	}
+
+	return h;
+}
+
+
+/** The regularized incomplete beta function I_x(a,b). */
+
+CTEST_SECTION static double incomplete_beta(double a, double b, double x)
+{
+	double front;
+
+	if(x <= 0) return 0;
+	if(x >= 1) return 1;
+
+	front = exp(log_gamma(a+b) - log_gamma(a) - log_gamma(b) + a*log(x) + b*log(1-x));
+	if(x < (a+1) / (a+b+2)) {
+		return front * beta_fraction(a, b, x) / a;
+	}
+	return 1 - front * beta_fraction(b, a, 1-x) / b;
+}
+
+
+CTEST_SECTION double ctest_student_t_p(double t, double df)
+{
+	return incomplete_beta(df/2, 0.5, df / (df + t*t));
+}
+
+
+CTEST_SECTION double ctest_student_t_critical(double confidence, double df)
+{
+	double low = 0, high = 1000, mid;
+	int i;
+
+	/* the p-value falls as t rises so just bisect */
+	for(i=0; i<100; i++) {
+		mid = (low + high) / 2;
+		if(ctest_student_t_p(mid, df) > 1 - confidence) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return (low + high) / 2;
+}
+
+
+/** Sorts values and returns their median. */
+
+CTEST_SECTION static int compare_doubles(const void *a, const void *b)
+{
+	double diff = *(const double*)a - *(const double*)b;
+	return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+
+CTEST_SECTION static double median(double *values, int count)
+{
+	qsort(values, count, sizeof(double), compare_doubles);
+	if(count % 2) {
+		return values[count/2];
+	}
+	return (values[count/2 - 1] + values[count/2]) / 2;
+}
+
+
+/** Returns the median absolute deviation from med.  Overwrites values. */
+
+CTEST_SECTION static double median_deviation(double *values, int count, double med)
+{
+	int i;
+
+	for(i=0; i<count; i++) {
+		values[i] = fabs(values[i] - med);
+	}
+	return median(values, count);
+}
+
+
+/*
+ *  Instruction counting
+ *
+ *  On Linux, perf events count the instructions that the calling thread
+ *  runs in user space.  That's much more repeatable than the clock, so
+ *  it's used whenever the kernel and hardware allow it.
+ */
+
+#ifdef CTEST_PERF
+/** -2 if the counter hasn't been opened yet, -1 if it couldn't be. */
+static int counter_fd = -2;
+#endif
+
+
+/** Returns the number of instructions this thread has run, or -1 if
+ *  they can't be counted. */
+
+CTEST_SECTION static double read_instructions()
+{
+#ifdef CTEST_PERF
+	struct perf_event_attr attr;
+	__u64 count;
+
+	if(counter_fd == -2) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		counter_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if(counter_fd < 0) {
+			counter_fd = -1;
+		}
+	}
+
+	if(counter_fd >= 0 && read(counter_fd, &count, sizeof(count)) == sizeof(count)) {
+		return (double)count;
+	}
+#endif
+	return -1;
+}
+
+
+/** Formats a duration with a sensible unit. */
+
+CTEST_SECTION static const char* format_seconds(char *buf, double seconds)
+{
+	if(seconds >= 1) {
+		sprintf(buf, "%.3f s", seconds);
+	} else if(seconds >= 1e-3) {
+		sprintf(buf, "%.3f ms", seconds * 1e3);
+	} else {
+		sprintf(buf, "%.3f us", seconds * 1e6);
+	}
+	return buf;
+}
+
+
+/*
+ *  Performance budgets
+ *
+ *  The block is run once to warm up and then budget->runs more times.
+ *  The median run is compared against the budget: a few runs that were
+ *  slowed down by a noisy neighbor don't move the median, so budgets
+ *  can be tight without being flaky.
+ */
+
+#define BUDGET_DEFAULT_RUNS 15
+
+
+CTEST_SECTION void ctest_internal_budget_begin(struct ctest_budget *budget, const char *file, int line)
+{
+	if(budget->runs <= 0) {
+		budget->runs = BUDGET_DEFAULT_RUNS;
+	}
+	if(budget->runs > CTEST_BUDGET_MAX_RUNS) {
+		budget->runs = CTEST_BUDGET_MAX_RUNS;
+	}
+	budget->file = file;
+	budget->line = line;
+	/* -1 is the warmup run */
+	budget->run = -2;
+	budget->counting = read_instructions() >= 0;
+}
+
+
+CTEST_SECTION static void budget_finish(struct ctest_budget *budget)
+{
+	const char *name = budget->name ? budget->name : "block";
+	char took[32], spread[32], allowed[32];
+
+	budget->seconds = median(budget->times, budget->runs);
+	budget->seconds_mad = median_deviation(budget->times, budget->runs, budget->seconds);
+	budget->instructions = budget->counting ? median(budget->counts, budget->runs) : -1;
+
+	if(budget->max_seconds > 0) {
+		ctest_assert_fmt(budget->seconds <= budget->max_seconds, budget->file, budget->line,
+			"%s took %s (median of %d runs, MAD %s), its budget is %s", name,
+			format_seconds(took, budget->seconds), budget->runs,
+			format_seconds(spread, budget->seconds_mad),
+			format_seconds(allowed, budget->max_seconds));
+	}
+
+	if(budget->max_instructions > 0) {
+		if(budget->counting) {
+			ctest_assert_fmt(budget->instructions <= budget->max_instructions, budget->file, budget->line,
+				"%s ran %.0f instructions (median of %d runs), its budget is %.0f", name,
+				budget->instructions, budget->runs, budget->max_instructions);
+		} else if(budget->max_seconds <= 0) {
+			fprintf(ctest_stderr(), "%s:%d: can't count instructions here, %s's budget wasn't checked.\n",
+				budget->file, budget->line, name);
+		}
+	}
+}
+
+
+/** Called before each run of the block.  Records the run that just
+ *  finished and returns 0 when the budget has been checked.
+ */
+
+CTEST_SECTION int ctest_internal_budget_next(struct ctest_budget *budget)
+{
+	double count = budget->counting ? read_instructions() : 0;
+	double now = ctest_now();
+
+	if(budget->run >= 0) {
+		budget->times[budget->run] = now - budget->start;
+		budget->counts[budget->run] = count - budget->start_count;
+	}
+
+	budget->run += 1;
+	if(budget->run >= budget->runs) {
+		budget_finish(budget);
+		return 0;
+	}
+
+	budget->start = ctest_now();
+	budget->start_count = budget->counting ? read_instructions() : 0;
+	return 1;
+}
+
+
+/*
+ *  A/B comparisons
+ *
+ *  First the comparison calibrates: both variants are run with more
+ *  and more repetitions until each sample takes at least AB_MIN_SAMPLE
+ *  seconds, which also warms the caches.  Then it times pairs of
+ *  samples, alternating AB, BA, AB, ... so that slow drift affects
+ *  both variants equally.  Each pair gives the log of A's time over
+ *  B's.  Their mean and variance give the speedup, its confidence
+ *  interval and a paired t-test of whether B differs from A at all.
+ */
+
+#define AB_DEFAULT_PAIRS 30
+#define AB_MIN_SAMPLE 0.001
+#define AB_MAX_REPS 1000000000L
+
+#define AB_CALIBRATING 0
+#define AB_MEASURING 1
+
+
+CTEST_SECTION void ctest_internal_ab_begin(struct ctest_ab *ab, const char *file, int line)
+{
+	if(ab->pairs <= 0) {
+		ab->pairs = AB_DEFAULT_PAIRS;
+	}
+	ab->file = file;
+	ab->line = line;
+	ab->phase = AB_CALIBRATING;
+	ab->reps = 1;
+	ab->pair = 0;
+	ab->order = 0;
+	ab->variant = -1;
+	ab->a_time = ab->b_time = 0;
+	ab->a_seconds = ab->b_seconds = 0;
+	ab->log_mean = ab->log_m2 = 0;
+}
+
+
+CTEST_SECTION static void ab_finish(struct ctest_ab *ab)
+{
+	double df = ab->pairs - 1;
+	double sd = df > 0 ? sqrt(ab->log_m2 / df) : 0;
+	double err = sd / sqrt((double)ab->pairs);
+	double tcrit = ctest_student_t_critical(0.95, df > 0 ? df : 1);
+
+	ab->speedup = exp(ab->log_mean);
+	ab->speedup_low = exp(ab->log_mean - tcrit * err);
+	ab->speedup_high = exp(ab->log_mean + tcrit * err);
+	ab->p_value = err > 0 ? ctest_student_t_p(ab->log_mean / err, df) : (ab->log_mean ? 0 : 1);
+	ab->a_seconds /= ab->pairs * (double)ab->reps;
+	ab->b_seconds /= ab->pairs * (double)ab->reps;
+
+	fprintf(ctest_stdout(), "%s: B is %.3fx %s than A (95%% CI %.3fx to %.3fx, p=%.4f, %d pairs of %ld runs)\n",
+		ab->name ? ab->name : "A/B",
+		ab->speedup >= 1 ? ab->speedup : 1/ab->speedup,
+		ab->speedup >= 1 ? "faster" : "slower",
+		ab->speedup_low, ab->speedup_high, ab->p_value, ab->pairs, ab->reps);
+
+	if(ab->min_speedup > 0) {
+		ctest_assert_fmt(ab->speedup_low >= ab->min_speedup, ab->file, ab->line,
+			"%s: B should be at least %.3fx faster than A but is %.3fx (95%% CI %.3fx to %.3fx)",
+			ab->name ? ab->name : "A/B", ab->min_speedup,
+			ab->speedup, ab->speedup_low, ab->speedup_high);
+	}
+}
+
+
+/** Called once before each run of the block.  Stops the timer for the
+ *  variant that just ran, then picks the next variant and starts the
+ *  timer for it.  Returns 0 when the comparison is done.
+ */
+
+CTEST_SECTION int ctest_internal_ab_next(struct ctest_ab *ab)
+{
+	double now = ctest_now();
+	double ratio, delta;
+
+	if(ab->variant == 0) {
+		ab->a_time = now - ab->start;
+	} else if(ab->variant == 1) {
+		ab->b_time = now - ab->start;
+	}
+
+	/* a sample is complete once both variants have run */
+	if(ab->variant >= 0 && ab->variant != ab->order) {
+		if(ab->phase == AB_CALIBRATING) {
+			if((ab->a_time < AB_MIN_SAMPLE || ab->b_time < AB_MIN_SAMPLE) && ab->reps < AB_MAX_REPS) {
+				ab->reps *= 2;
+			} else {
+				ab->phase = AB_MEASURING;
+			}
+		} else {
+			ratio = log(ab->a_time / ab->b_time);
+			ab->pair += 1;
+			delta = ratio - ab->log_mean;
+			ab->log_mean += delta / ab->pair;
+			ab->log_m2 += delta * (ratio - ab->log_mean);
+			ab->a_seconds += ab->a_time;
+			ab->b_seconds += ab->b_time;
+			/* alternate AB, BA, AB, ... */
+			ab->order = !ab->order;
+			if(ab->pair >= ab->pairs) {
+				ab->variant = -1;
+				ab_finish(ab);
+				return 0;
+			}
+		}
+		ab->variant = ab->order;
+	} else {
+		ab->variant = ab->variant < 0 ? ab->order : !ab->variant;
+	}
+
+	ab->start = ctest_now();
+	return 1;
+}
+
+
+/*
+ *  Complexity
+ *
+ *  The body is measured at n = min_n, 2*min_n, 4*min_n ... until n
+ *  reaches max_n or a single call takes COMPLEXITY_MAX_CALL seconds.
+ *  Each candidate class f is fitted in log space, log(cost) = log(a) +
+ *  log(f(n)), so every size counts equally no matter how expensive it
+ *  is.  The class whose residuals have the smallest standard deviation
+ *  is the one the body fits.
+ */
+
+#define COMPLEXITY_DEFAULT_MIN_N 64
+#define COMPLEXITY_DEFAULT_MAX_N (1L << 20)
+#define COMPLEXITY_MAX_CALL 0.02
+#define COMPLEXITY_MIN_POINTS 4
+/** the body is repeated until a timed sample takes at least this long. */
+#define COMPLEXITY_MIN_SAMPLE 0.001
+/** the expected class passes if it fits at least this well, even if a
+ *  worse class fits a little better (cache effects, noise...). */
+#define COMPLEXITY_TOLERANCE 0.15
+
+static const char *complexity_names[] = {
+	"O(1)", "O(log n)", "O(n)", "O(n log n)", "O(n^2)", "O(n^3)"
+};
+
+
+CTEST_SECTION static double complexity_of(int class, double n)
+{
+	switch(class) {
+		case CTEST_O_1: return 1;
+		case CTEST_O_LOG_N: return log(n);
+		case CTEST_O_N: return n;
+		case CTEST_O_N_LOG_N: return n * log(n);
+		case CTEST_O_N2: return n * n;
+	}
+	return n * n * n;
+}
+
+
+/** Returns the standard deviation of the residuals of fitting class to the points. */
+
+CTEST_SECTION static double complexity_error(struct ctest_complexity *cplx, int class)
+{
+	double resid, mean = 0, m2 = 0, delta;
+	int i;
+
+	for(i=0; i<cplx->points; i++) {
+		resid = log(cplx->cost[i]) - log(complexity_of(class, (double)cplx->n[i]));
+		delta = resid - mean;
+		mean += delta / (i+1);
+		m2 += delta * (resid - mean);
+	}
+	return sqrt(m2 / (cplx->points - 1));
+}
+
+
+/** Returns the cost of one call of body(data, n).  Sets *seconds to
+ *  how long one call took. */
+
+CTEST_SECTION static double complexity_measure(void (*body)(void *data, long n), void *data,
+	long n, int counting, double *seconds)
+{
+	double best = -1, cost, start, elapsed;
+	long reps = 1, i;
+	int trial;
+
+	/* warm up and find out how many calls make a sample long enough to time */
+	for(;;) {
+		start = ctest_now();
+		for(i=0; i<reps; i++) {
+			body(data, n);
+		}
+		elapsed = ctest_now() - start;
+		if(counting || elapsed >= COMPLEXITY_MIN_SAMPLE || reps >= AB_MAX_REPS) {
+			break;
+		}
+		reps *= 2;
+	}
+	*seconds = elapsed / reps;
+
+	/* the cheapest of three samples has the least noise in it */
+	for(trial=0; trial<3; trial++) {
+		if(counting) {
+			start = read_instructions();
+			body(data, n);
+			cost = read_instructions() - start;
+		} else {
+			start = ctest_now();
+			for(i=0; i<reps; i++) {
+				body(data, n);
+			}
+			cost = (ctest_now() - start) / reps;
+		}
+		if(best < 0 || cost < best) {
+			best = cost;
+		}
+	}
+
+	/* instructions can't be zero but a tiny function might take no time at all */
+	return best > 0 ? best : 1e-12;
+}
+
+
+CTEST_SECTION static void print_complexity_points(struct ctest_complexity *cplx, const char *name,
+	const char *file, int line)
+{
+	char buf[32];
+	int i;
+
+	fprintf(ctest_stderr(), "%s:%d: %s costs %s:\n", file, line, name,
+		cplx->counted ? "in instructions" : "in time");
+	for(i=0; i<cplx->points; i++) {
+		if(cplx->counted) {
+			fprintf(ctest_stderr(), "    n=%-9ld %.0f\n", cplx->n[i], cplx->cost[i]);
+		} else {
+			fprintf(ctest_stderr(), "    n=%-9ld %s\n", cplx->n[i], format_seconds(buf, cplx->cost[i]));
+		}
+	}
+}
+
+
+CTEST_SECTION void ctest_internal_complexity(struct ctest_complexity *cplx, void (*body)(void *data, long n),
+	void *data, const char *file, int line)
+{
+	const char *name = cplx->name ? cplx->name : "body";
+	long n = cplx->min_n > 0 ? cplx->min_n : COMPLEXITY_DEFAULT_MIN_N;
+	long max_n = cplx->max_n > 0 ? cplx->max_n : COMPLEXITY_DEFAULT_MAX_N;
+	double seconds, error, best_error = -1;
+	int class;
+
+	cplx->counted = read_instructions() >= 0;
+	cplx->points = 0;
+	while(n <= max_n && cplx->points < CTEST_COMPLEXITY_POINTS) {
+		cplx->n[cplx->points] = n;
+		cplx->cost[cplx->points] = complexity_measure(body, data, n, cplx->counted, &seconds);
+		cplx->points += 1;
+		if(seconds >= COMPLEXITY_MAX_CALL || n > max_n / 2) {
+			break;
+		}
+		n *= 2;
+	}
+
+	if(cplx->points < COMPLEXITY_MIN_POINTS) {
+		print_complexity_points(cplx, name, file, line);
+		ctest_assert_fmt(0, file, line, "%s: only measured %d sizes, need at least %d",
+			name, cplx->points, COMPLEXITY_MIN_POINTS);
+		return;
+	}
+
+	for(class=CTEST_O_1; class<=CTEST_O_N3; class++) {
+		cplx->error[class] = error = complexity_error(cplx, class);
+		if(best_error < 0 || error < best_error) {
+			best_error = error;
+			cplx->fitted = class;
+		}
+	}
+
+	if(cplx->fitted > cplx->expected && cplx->error[cplx->expected] > COMPLEXITY_TOLERANCE) {
+		print_complexity_points(cplx, name, file, line);
+	}
+	ctest_assert_fmt(cplx->fitted <= cplx->expected || cplx->error[cplx->expected] <= COMPLEXITY_TOLERANCE,
+		file, line, "%s should be %s or better but fits %s", name,
+		complexity_names[cplx->expected], complexity_names[cplx->fitted]);
+}
+
+
+/*
+ *  Stress runs
+ *
+ *  Each step starts its threads behind a gate, opens the gate, sleeps
+ *  for the step's duration and then tells the threads to stop.  The
+ *  throughput is the number of calls they made divided by the time
+ *  from opening the gate to the last thread stopping.  Passing asserts
+ *  are counted by their worker and added to ::ctest_batch_passes when
+ *  the step is done, other asserts are serialized by stress_lock so
+ *  they don't limit the scaling we're measuring.  An assert that fails
+ *  longjmps back to its own worker's loop, which stops every thread.
+ */
+
+#define STRESS_DEFAULT_SECONDS 0.1
+
+struct stress_run {
+	void (*body)(void *data, int thread);
+	void *data;
+	/** set when the threads should stop calling body.  Use
+	 *  STRESS_STOPPED and STRESS_STOP, it's shared between threads. */
+	int stop;
+	/** the thread whose assert failed, or -1. */
+	int failed_thread;
+	/** true if passing asserts only need to be counted. */
+	int fast_asserts;
+};
+
+struct stress_worker {
+	struct stress_run *run;
+	int index;
+	long calls;
+	/** the asserts that passed on this thread and weren't counted yet. */
+	long passes;
+#ifdef CTEST_THREADS
+	pthread_t thread;
+	jmp_buf jmp;
+#endif
+};
+
+
+CTEST_SECTION static void print_stress_step(struct ctest_stress *stress, const char *name)
+{
+	int i = stress->steps - 1;
+	double speedup = stress->throughput[i] / stress->throughput[0];
+
+	fprintf(ctest_stdout(), "%s: %2d thread%s %12.0f calls/s", name, stress->threads[i],
+		(stress->threads[i] == 1 ? " " : "s"), stress->throughput[i]);
+	if(i > 0) {
+		fprintf(ctest_stdout(), "  %.2fx speedup  %3.0f%% efficiency", speedup,
+			100 * speedup / stress->threads[i]);
+	}
+	fprintf(ctest_stdout(), "\n");
+}
+
+
+#ifdef CTEST_THREADS
+
+#ifdef __ATOMIC_ACQUIRE
+#define STRESS_STOPPED(run) __atomic_load_n(&(run)->stop, __ATOMIC_ACQUIRE)
+#define STRESS_STOP(run) __atomic_store_n(&(run)->stop, 1, __ATOMIC_RELEASE)
+#else
+#define STRESS_STOPPED(run) __sync_fetch_and_add(&(run)->stop, 0)
+#define STRESS_STOP(run) __sync_lock_test_and_set(&(run)->stop, 1)
+#endif
+
+static pthread_mutex_t stress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t stress_gate = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stress_once = PTHREAD_ONCE_INIT;
+/** each worker thread's struct stress_worker. */
+static pthread_key_t stress_key;
+
+
+CTEST_SECTION static void stress_make_key()
+{
+	pthread_key_create(&stress_key, NULL);
+}
+
+
+CTEST_SECTION static int stress_pass()
+{
+	struct stress_worker *worker = pthread_getspecific(stress_key);
+
+	if(!worker->run->fast_asserts) {
+		return 0;
+	}
+	worker->passes += 1;
+	return 1;
+}
+
+
+CTEST_SECTION static void stress_lock_asserts()
+{
+	pthread_mutex_lock(&stress_lock);
+}
+
+
+CTEST_SECTION static void stress_unlock_asserts()
+{
+	pthread_mutex_unlock(&stress_lock);
+}
+
+
+CTEST_SECTION static void stress_fail()
+{
+	struct stress_worker *worker = pthread_getspecific(stress_key);
+	longjmp(worker->jmp, 1);
+}
+
+
+static struct ctest_internal_threads stress_threads = {
+	stress_pass, stress_lock_asserts, stress_unlock_asserts, stress_fail
+};
+
+
+CTEST_SECTION static void* stress_worker_main(void *arg)
+{
+	struct stress_worker *worker = arg;
+	struct stress_run *run = worker->run;
+
+	pthread_setspecific(stress_key, worker);
+
+	/* wait for the rest of the threads to start */
+	pthread_mutex_lock(&stress_gate);
+	pthread_mutex_unlock(&stress_gate);
+
+	if(setjmp(worker->jmp)) {
+		pthread_mutex_lock(&stress_lock);
+		if(run->failed_thread < 0) {
+			run->failed_thread = worker->index;
+		}
+		STRESS_STOP(run);
+		pthread_mutex_unlock(&stress_lock);
+		return NULL;
+	}
+
+	while(!STRESS_STOPPED(run)) {
+		run->body(run->data, worker->index);
+		worker->calls += 1;
+	}
+
+	return NULL;
+}
+
+
+CTEST_SECTION static int cpu_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+}
+
+
+/** Runs body on count threads.  Returns the number of threads that
+ *  could be started and stores their calls per second in throughput.
+ */
+
+CTEST_SECTION static int stress_step(struct stress_run *run, struct stress_worker *workers,
+	int count, double seconds, double *throughput)
+{
+	struct timespec nap;
+	double start;
+	long calls = 0, passes = 0;
+	int i, started;
+
+	run->stop = 0;
+	pthread_mutex_lock(&stress_gate);
+	for(started=0; started<count; started++) {
+		workers[started].run = run;
+		workers[started].index = started;
+		workers[started].calls = 0;
+		workers[started].passes = 0;
+		if(pthread_create(&workers[started].thread, NULL, stress_worker_main, &workers[started]) != 0) {
+			STRESS_STOP(run);
+			break;
+		}
+	}
+	start = ctest_now();
+	pthread_mutex_unlock(&stress_gate);
+
+	nap.tv_sec = (time_t)seconds;
+	nap.tv_nsec = (long)((seconds - nap.tv_sec) * 1e9);
+	nanosleep(&nap, NULL);
+	STRESS_STOP(run);
+
+	for(i=0; i<started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		calls += workers[i].calls;
+		passes += workers[i].passes;
+	}
+	*throughput = calls / (ctest_now() - start);
+	/* the workers that hadn't been joined yet could still be counting
+	 * their own asserts into it under stress_lock */
+	ctest_batch_passes += passes;
+
+	return started;
+}
+
+#else
+
+/** Without threads we can only measure a single thread. */
+
+CTEST_SECTION static int cpu_count()
+{
+	return 1;
+}
+
+
+CTEST_SECTION static int stress_step(struct stress_run *run, struct stress_worker *workers,
+	int count, double seconds, double *throughput)
+{
+	double start = ctest_now(), now;
+
+	workers[0].calls = 0;
+	do {
+		run->body(run->data, 0);
+		workers[0].calls += 1;
+		now = ctest_now();
+	} while(now - start < seconds);
+	*throughput = workers[0].calls / (now - start);
+
+	return 1;
+}
+
+#endif
+
+
+CTEST_SECTION void ctest_internal_stress(struct ctest_stress *stress, void (*body)(void *data, int thread),
+	void *data, const char *file, int line)
+{
+	const char *name = stress->name ? stress->name : "stress";
+	struct stress_run run;
+	struct stress_worker *workers;
+	double throughput;
+	int max, count, started, fast_asserts;
+
+	max = stress->max_threads > 0 ? stress->max_threads : cpu_count();
+	if(stress->seconds <= 0) {
+		stress->seconds = STRESS_DEFAULT_SECONDS;
+	}
+
+	workers = malloc(max * sizeof(struct stress_worker));
+	if(!workers) {
+		fprintf(ctest_stderr(), "Out of memory allocating %d stress threads!\n", max);
+		exit(239);
+	}
+
+	run.body = body;
+	run.data = data;
+	run.failed_thread = -1;
+
+#ifdef CTEST_THREADS
+	pthread_once(&stress_once, stress_make_key);
+	ctest_internal_threads = &stress_threads;
+#endif
+	/* ctest.hpp's passing asserts can't bump the shared batch counter */
+	fast_asserts = ctest_fast_asserts;
+	run.fast_asserts = fast_asserts;
+	ctest_fast_asserts = 0;
+
+	stress->steps = 0;
+	count = 1;
+	for(;;) {
+		started = stress_step(&run, workers, count, stress->seconds, &throughput);
+		if(started < count || run.failed_thread >= 0) {
+			break;
+		}
+		stress->threads[stress->steps] = count;
+		stress->throughput[stress->steps] = throughput;
+		stress->steps += 1;
+		print_stress_step(stress, name);
+		if(count >= max || stress->steps >= CTEST_STRESS_STEPS) {
+			break;
+		}
+		count = count*2 < max ? count*2 : max;
+	}
+
+	ctest_fast_asserts = fast_asserts;
+	ctest_internal_threads = NULL;
+	free(workers);
+
+	if(run.failed_thread >= 0) {
+		ctest_assert_fmt(0, file, line, "%s: an assert failed on thread %d while running %d",
+			name, run.failed_thread, count);
+	}
+	if(started < count) {
+		ctest_assert_fmt(0, file, line, "%s: could only start %d of %d threads",
+			name, started, count);
+	}
+
+	if(stress->steps == 0) {
+		return;
+	}
+
+	stress->speedup = stress->throughput[stress->steps-1] / stress->throughput[0];
+	stress->efficiency = stress->speedup / stress->threads[stress->steps-1];
+
+	if(stress->min_speedup > 0) {
+		ctest_assert_fmt(stress->speedup >= stress->min_speedup, file, line,
+			"%s: %d threads should be at least %.2fx faster than 1 but are %.2fx",
+			name, stress->threads[stress->steps-1], stress->min_speedup, stress->speedup);
+	}
+}
@@ -0,0 +1,264 @@
+/* ctbench.h
+ * The ctest contributors
+ * 19 Oct 2026
+ *
+ * Copyright (C) 2026 The ctest contributors
+ * This file is released under the MIT License.
+ * See http://www.opensource.org/licenses/mit-license.php
+ */
+
+
+/* @file ctbench.h
+ *
+ * Benchmarks that live in your unit tests.  Like the asserts in
+ * ctassert.h, a benchmark that doesn't meet its requirements fails
+ * the enclosing test.
+ *
+ * A/B comparisons run an old and a new implementation in the same
+ * process, alternating between them so that frequency scaling and
+ * thermal drift affect both equally:
+ *
+ * <pre>
+ *   struct ctest_ab ab = { "sum", 0, 1.10 };
+ *   ctest_ab(&ab) {
+ *       ctest_variant_a(&ab) { old_sum(data, n); }
+ *       ctest_variant_b(&ab) { new_sum(data, n); }
+ *   }
+ * </pre>
+ *
+ * prints something like
+ *
+ * <pre>
+ *   sum: B is 1.312x faster than A (95% CI 1.298x to 1.327x, p=0.0000, 30 pairs)
+ * </pre>
+ *
+ * and, because min_speedup is 1.10, fails the test unless we're 95%
+ * confident that B is at least 10% faster than A.
+ *
+ * Performance budgets fail a test when a block takes too long or runs
+ * too many instructions:
+ *
+ * <pre>
+ *   struct ctest_budget budget = { "parse 1 MB", 5e-3, 20e6 };
+ *   ctest_budget(&budget) {
+ *       parse(fixture, fixture_len);
+ *   }
+ * </pre>
+ *
+ * The block runs once to warm up and then 15 more times, and the median
+ * of those runs is compared to the budget, so a few slow runs on a busy
+ * machine don't fail the test.  Instructions can only be counted on
+ * Linux and only when the kernel allows it.  When they can't be, the
+ * instruction budget is skipped with a warning.
+ *
+ * Complexity checks catch accidentally quadratic code.  The body is
+ * called with n = 64, 128, 256 ... and the costs are fitted against
+ * O(1), O(log n), O(n), O(n log n), O(n^2) and O(n^3):
+ *
+ * <pre>
+ *   static void sort_n(void *data, long n) { sort(data, n); }
+ *
+ *   struct ctest_complexity cplx = { "sort", CTEST_O_N_LOG_N };
+ *   ctest_complexity(&cplx, sort_n, array);
+ * </pre>
+ *
+ * fails the test, printing the costs it measured, if sort fits a class
+ * worse than O(n log n).
+ *
+ * Stress runs call a function over and over on 1, 2, 4 ... N threads
+ * to check that a concurrent data structure is both correct and
+ * scalable:
+ *
+ * <pre>
+ *   static void push_pop(void *data, int thread) {
+ *       struct queue *q = data;
+ *       queue_push(q, thread);
+ *       AssertNonNegative(queue_pop(q));
+ *   }
+ *
+ *   struct ctest_stress stress = { "queue", 8, 3.0 };
+ *   ctest_stress(&stress, push_pop, &q);
+ * </pre>
+ *
+ * prints the throughput at each thread count
+ *
+ * <pre>
+ *   queue:  1 thread     5012345 calls/s
+ *   queue:  2 threads    9876543 calls/s  1.97x speedup   99% efficiency
+ *   ...
+ * </pre>
+ *
+ * and fails the test unless 8 threads get at least 3x the throughput
+ * of one.  An assert that fails on any thread fails the enclosing test
+ * and stops the stress run.
+ */
+
+
+#ifndef CTEST_BENCH_H
+#define CTEST_BENCH_H
+
+#include "ctest.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** An A/B comparison.  Fill in the first three fields, zero the rest. */
+struct ctest_ab {
+	/** the name printed with the results. */
+	const char *name;
+	/** the number of A/B pairs to time, or 0 for the default (30). */
+	int pairs;
+	/** if nonzero, the test fails unless the lower bound of the 95%
+	 *  confidence interval for B's speedup over A is at least this. */
+	double min_speedup;
+
+	/** The results, filled in when the comparison is done.
+	 *  speedup is A's time divided by B's: 2.0 means B is twice as fast. */
+	double speedup, speedup_low, speedup_high, p_value;
+	double a_seconds, b_seconds;
+
+	/* The following are maintained by ctest. */
+	int variant;
+	long reps, rep;
+	int phase, pair, order;
+	double start, a_time, b_time;
+	double log_mean, log_m2;
+	const char *file;
+	int line;
+};
+
+/** Runs the block that follows until the comparison is done. */
+#define ctest_ab(ab) \
+	for(ctest_internal_ab_begin(ab, __FILE__, __LINE__); ctest_internal_ab_next(ab); )
+
+/** The A variant, usually the old implementation. */
+#define ctest_variant_a(ab) \
+	if((ab)->variant == 0) for((ab)->rep = 0; (ab)->rep < (ab)->reps; (ab)->rep++)
+/** The B variant, usually the new implementation. */
+#define ctest_variant_b(ab) \
+	if((ab)->variant == 1) for((ab)->rep = 0; (ab)->rep < (ab)->reps; (ab)->rep++)
+
+
+/** The most runs a performance budget will measure. */
+#define CTEST_BUDGET_MAX_RUNS 101
+
+/** A performance budget.  Fill in the first four fields, zero the rest. */
+struct ctest_budget {
+	/** the name printed with the results. */
+	const char *name;
+	/** if nonzero, the most seconds the median run may take. */
+	double max_seconds;
+	/** if nonzero, the most instructions the median run may take. */
+	double max_instructions;
+	/** the number of runs to measure, or 0 for the default (15). */
+	int runs;
+
+	/** The results, filled in when the block is done: the median
+	 *  run's seconds and instructions, and the median absolute deviation
+	 *  of the times.  instructions is -1 if they couldn't be counted. */
+	double seconds, seconds_mad, instructions;
+
+	/* The following are maintained by ctest. */
+	int run, counting;
+	double start, start_count;
+	double times[CTEST_BUDGET_MAX_RUNS];
+	double counts[CTEST_BUDGET_MAX_RUNS];
+	const char *file;
+	int line;
+};
+
+/** Runs the block that follows and fails the test if it's over budget. */
+#define ctest_budget(budget) \
+	for(ctest_internal_budget_begin(budget, __FILE__, __LINE__); ctest_internal_budget_next(budget); )
+
+
+/** Complexity classes, best to worst. */
+enum {
+	CTEST_O_1, CTEST_O_LOG_N, CTEST_O_N, CTEST_O_N_LOG_N, CTEST_O_N2, CTEST_O_N3
+};
+
+/** The most sizes that a complexity check will measure. */
+#define CTEST_COMPLEXITY_POINTS 32
+
+/** A complexity check.  Fill in the first four fields, zero the rest. */
+struct ctest_complexity {
+	/** the name printed with the results. */
+	const char *name;
+	/** the worst complexity class the body may have, CTEST_O_N etc. */
+	int expected;
+	/** the smallest and largest n to try, or 0 for 64 and 2^20.  Sizes
+	 *  stop growing early once a single call takes 20 ms. */
+	long min_n, max_n;
+
+	/** The results: the cost of one call at each n, in instructions if
+	 *  counted is true and in seconds if not, the standard deviation of
+	 *  each class's fit (in log space) and the class that fit best. */
+	int points, counted;
+	long n[CTEST_COMPLEXITY_POINTS];
+	double cost[CTEST_COMPLEXITY_POINTS];
+	double error[CTEST_O_N3 + 1];
+	int fitted;
+};
+
+/** Measures body(data, n) at growing sizes and fails the test if it
+ *  doesn't fit complexity->expected or better. */
+#define ctest_complexity(complexity, body, data) \
+	ctest_internal_complexity(complexity, body, data, __FILE__, __LINE__)
+
+
+/** The most thread counts that a stress run will measure. */
+#define CTEST_STRESS_STEPS 16
+
+/** A stress run.  Fill in the first four fields, zero the rest. */
+struct ctest_stress {
+	/** the name printed with the results. */
+	const char *name;
+	/** the most threads to run at once, or 0 for the number of CPUs. */
+	int max_threads;
+	/** if nonzero, the test fails unless max_threads threads get at
+	 *  least this many times the throughput of a single thread. */
+	double min_speedup;
+	/** how long to run at each thread count, or 0 for the default (0.1s). */
+	double seconds;
+
+	/** The results, filled in when the run is done.  threads[i]
+	 *  threads made throughput[i] calls per second. */
+	int steps;
+	int threads[CTEST_STRESS_STEPS];
+	double throughput[CTEST_STRESS_STEPS];
+	/** speedup and parallel efficiency of the largest thread count. */
+	double speedup, efficiency;
+};
+
+/** Calls body(data, thread) in a loop on 1, 2, 4 ... max_threads
+ *  threads.  thread numbers the threads from 0.  Use the regular asserts
+ *  in body, not the Batch asserts or the ones in ctest.hpp.  A ctest_batch
+ *  block in body fails the test.
+ */
+#define ctest_stress(stress, body, data) \
+	ctest_internal_stress(stress, body, data, __FILE__, __LINE__)
+
+
+/* The following routines are not meant to be called directly. */
+void ctest_internal_budget_begin(struct ctest_budget *budget, const char *file, int line);
+int ctest_internal_budget_next(struct ctest_budget *budget);
+void ctest_internal_ab_begin(struct ctest_ab *ab, const char *file, int line);
+int ctest_internal_ab_next(struct ctest_ab *ab);
+void ctest_internal_complexity(struct ctest_complexity *complexity, void (*body)(void *data, long n),
+	void *data, const char *file, int line);
+void ctest_internal_stress(struct ctest_stress *stress, void (*body)(void *data, int thread),
+	void *data, const char *file, int line);
+
+/** Returns the two-sided p-value of Student's t statistic. */
+double ctest_student_t_p(double t, double df);
+/** Returns the critical t value for a two-sided confidence interval. */
+double ctest_student_t_critical(double confidence, double df);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,10 +9,35 @@
  * See http://www.opensource.org/licenses/mit-license.php
  */
 
+/* ctest itself is ANSI C but it uses a few POSIX calls when they're
+ * available (timers, mostly).  This must come before any includes. */
+#if defined(__unix__) || defined(__APPLE__)
+#define CTEST_POSIX 1
+#define _POSIX_C_SOURCE 200112L
+#define _XOPEN_SOURCE 600
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef CTEST_POSIX
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#if defined(CTEST_POSIX) && defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define CTEST_PROFILER 1
+#include <errno.h>
+#include <elf.h>
+#include <ucontext.h>
+#endif
 
 #include "ctest.h"
 
@@ -57,7 +82,7 @@
  */
 
 
-static struct {
+static struct ctest_metrics {
 	/** The number of tests that we have attempted. */
 	int tests_run;
 	/** The number of successful tests run. */
@@ -66,12 +91,28 @@ static struct {
 	int test_failures;
 	/** The number of assertions that have been attempted. */
 	int assertions_run;
+	/** The number of tests that were skipped without being run. */
+	int tests_skipped;
+	/** The number of tests that failed but then passed when retried. */
+	int tests_flaky;
 } metrics;
 
 
 struct ctest_preferences ctest_preferences;
 
 
+/** A snapshot of the process's memory usage.  All sizes are in kB. */
+struct memory_sample {
+	/** the current resident set size. */
+	long rss;
+	/** the highest resident set size since the peak was last reset. */
+	long peak;
+	/** page faults that did and didn't require I/O. */
+	long major_faults;
+	long minor_faults;
+};
+
+
 struct test {
 	/** usesd to maintain singly linked list of tests off ::test_head. */
 	struct test *next;
@@ -79,13 +120,61 @@ struct test {
 	struct ctest_jmp_wrapper jmp;
 	/** the name of the test or NULL if none was supplied */
 	const char *name;
+	/** the file and line of the ctest_start that started this test. */
+	const char *file;
+	int line;
+	/** the ctest_now() time when the test was started. */
+	double start_time;
 	/** True if we've already run the test in its entirety, false if not.  Needed because ctest_internal_test_finished() must be called twice: once when the test block is entered, and once when the block is exited.  We're only interested in the exit. */
 	int finished;
 	/** true if the sense of the assertions should be reversed. */
 	int inverted;
+	/** true if this test should be skipped rather than run. */
+	int skipped;
+	/** true if this test is skipped because it finished in an earlier run (see ::ctest_preferences.checkpoint). */
+	int resumed;
+	/** the number of times this test has been retried after failing. */
+	int retries;
+	/** if nonzero, the test keeps going after failed asserts until this many have failed. */
+	int soft_max;
+	/** the number of asserts that failed without stopping the test. */
+	int soft_failures;
+	/** true if tests nested directly inside this test should each be run in a forked process. */
+	int fork_children;
+	/** In a forked child, the pipe to report the results to the parent on, otherwise -1. */
+	int fork_pipe;
+	/** In a forked child, the metrics at the time of the fork. */
+	struct ctest_metrics fork_metrics;
+	/** In a forked child, ::impact_serial at the time of the fork. */
+	unsigned long fork_impact_serial;
+	/** true if memory usage was sampled when this test started. */
+	int mem_sampled;
+	/** The memory usage when this test started. */
+	struct memory_sample mem_start;
+	/** The highest RSS seen while this test was running, in kB. */
+	long mem_peak;
+	/** If nonzero, the test fails if its peak RSS grows by more than this many kB. */
+	long mem_budget;
+	/** If this test's output is being captured, the number of failed
+	 *  tests when it started.  Otherwise -1. */
+	int capture_failures;
+	/** Fixtures scoped to this test, most recently scoped first.  They're torn down when the test finishes. */
+	struct ctest_fixture *fixtures;
+	/** The source files this test depends on (see ::record_source_file). */
+	const char **files;
+	int files_count;
+	int files_size;
+	/** the index of this test's path in the profile (see ::profile_test). */
+	int profile_id;
 };
 /** tests are listed off this list head, from most nested to least nested. */
 struct test *test_head;
+/** the ::profile_id of test_head, read by the profiler's signal handler. */
+static volatile int profile_test;
+#ifdef CTEST_PROFILER
+/* the profiler is further down, asserts and test starts call this */
+static void check_profile();
+#endif
 
 
 /**
@@ -93,10 +182,11 @@ struct test *test_head;
  * Tests are linked from most nested to least nested off test_head.
  */
 
-static void test_push(struct test *test)
+CTEST_SECTION static void test_push(struct test *test)
 {
 	test->next = test_head;
 	test_head = test;
+	profile_test = test->profile_id;
 }
 
 
@@ -104,222 +194,3877 @@ static void test_push(struct test *test)
  * Dispose of the current test_head moving the next test in the chain into its place.
  */
 
-static void test_pop()
+CTEST_SECTION static void test_pop()
 {
 	struct test *test = test_head;
 	test_head = test->next;
+	profile_test = test_head ? test_head->profile_id : 0;
+	free(test->files);
 	free(test);
 }
 
 
-static void print_test_indentation()
+CTEST_SECTION static void *ctest_malloc(size_t size)
 {
-	struct test *test;
+	void *ptr = malloc(size);
+	if(!ptr) {
+		fprintf(ctest_stderr(), "Out of memory allocating %lu bytes!\n", (unsigned long)size);
+		exit(239);
+	}
+	return ptr;
+}
 
-	for(test=test_head; test; test=test->next) {
-		printf("  ");
+
+CTEST_SECTION static void *ctest_realloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if(!ptr) {
+		fprintf(ctest_stderr(), "Out of memory reallocating %lu bytes!\n", (unsigned long)size);
+		exit(239);
 	}
+	return ptr;
 }
 
 
-void ctest_assert(int success, const char *file, int line, const char *msg)
+CTEST_SECTION static char *ctest_strdup(const char *str)
 {
-	if(test_head && test_head->inverted)
-		success = !success;
+	return strcpy(ctest_malloc(strlen(str)+1), str);
+}
 
-	if(!success || (ctest_preferences.show_failures && test_head && test_head->inverted)) {
-		fprintf(stderr, "%s:%d: assert failed: %s!\n", file, line, msg);
+
+/** Reads a line of any length from fp, stripping the trailing newline.
+ *  The line is stored in *bufp, which is grown as needed and must be
+ *  freed by the caller.  Returns NULL at EOF.
+ */
+
+CTEST_SECTION static char *read_line(FILE *fp, char **bufp, size_t *sizep)
+{
+	size_t len = 0;
+
+	if(!*bufp) {
+		*sizep = 256;
+		*bufp = ctest_malloc(*sizep);
 	}
 
-	metrics.assertions_run += 1;
-	if(success) {
-		if(ctest_preferences.verbosity >= 2) {
-			print_test_indentation();
-			printf("%d. %sassert %s at %s:%d: success\n",
-				metrics.assertions_run,
-				test_head && test_head->inverted ? "inverted " : "",
-				msg, file, line);
-		}
-	} else {
-		if(test_head) {
-			if(test_head->inverted) {
-				fprintf(stderr, "%s:%d: inverted assert was not expected to succeed: %s!\n", file, line, msg);
-			}
-			/* longjump to abort this test */
-			longjmp(test_head->jmp.jmp, 1);
-		} else {
-			exit(1); /* 1 because a single test failed */
+	while(fgets(*bufp + len, (int)(*sizep - len), fp)) {
+		len += strlen(*bufp + len);
+		if(len > 0 && (*bufp)[len-1] == '\n') {
+			(*bufp)[len-1] = '\0';
+			return *bufp;
 		}
+		*sizep *= 2;
+		*bufp = ctest_realloc(*bufp, *sizep);
 	}
+
+	return len > 0 ? *bufp : NULL;
 }
 
 
-void ctest_assert_fmt(int success, const char *file, int line, const char *msg, ...)
+/** Returns the current time in seconds.  Only useful for measuring
+ *  intervals: the starting point is arbitrary.  Uses a monotonic clock
+ *  if there is one, otherwise falls back to the CPU time.
+ */
+
+CTEST_SECTION double ctest_now()
 {
-	va_list ap;
-	char buf[BUFSIZ];
+#if defined(CTEST_POSIX) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+#endif
+	return (double)clock() / CLOCKS_PER_SEC;
+}
 
-	va_start(ap, msg);
-	/* Thanks to awful standardization, I don't get to use vsnprintf.
-         * For now we have an extremely unlikely but potential buffer overflow.
-         * Longer term, should probably figure out how to get rid of varargs entirely. */
-	vsprintf(buf, msg, ap);
-	va_end(ap);
 
-	ctest_assert(success, file, line, buf);
+/** Writes the names of the test and all the tests that enclose it,
+ *  outermost first, separated by slashes: "Parser/Numbers/Overflow".
+ */
+
+CTEST_SECTION static void write_test_path(FILE *fp, struct test *test)
+{
+	if(test->next) {
+		write_test_path(fp, test->next);
+		fputc('/', fp);
+	}
+	fputs(test->name, fp);
 }
 
 
-struct ctest_jmp_wrapper* ctest_internal_start_test(const char *name, const char *file, int line)
+/*
+ *  Test-impact index
+ *
+ *  Every assert passes its __FILE__ to ctest_assert().  When an impact
+ *  index is requested, each test remembers the files its asserts (and
+ *  its nested tests' asserts) came from.  Since tests normally live in
+ *  the same file as the code they're testing, this tells us which
+ *  tests need to be run when a given source file changes.
+ *
+ *  The index is a text file, one test per line, tab-separated:
+ *      file:line  name  dependency  dependency ...
+ */
+
+struct impact_record {
+	/** used to chain records in the same ::impact_table bucket. */
+	struct impact_record *next;
+	/** used to keep the records in the order they were created. */
+	struct impact_record *list_next;
+	/** "file:line\tname" of the ctest_start that began this test. */
+	char *key;
+	/** the source files this test depends on. */
+	char **files;
+	int files_count;
+	int files_size;
+	/** true if the files were recorded during this run, false if they were read from the index. */
+	int fresh;
+	/** true if one of the files is in ::ctest_preferences.changed. */
+	int affected;
+	/** the value of ::impact_serial when the files were last recorded. */
+	unsigned long serial;
+};
+
+#define IMPACT_TABLE_SIZE 4096
+static struct impact_record **impact_table;
+static struct impact_record *impact_list_head, **impact_list_tail = &impact_list_head;
+static int impact_loaded;
+/** counts calls to record_test_impact() so a forked child can tell
+ *  which records it changed. */
+static unsigned long impact_serial;
+
+
+CTEST_SECTION static unsigned long hash_string(const char *str)
 {
-	struct test* test = malloc(sizeof(struct test));
-	if(!test) {
-		fprintf(stderr, "Out of memory allocating struct test!\n");
-		exit(239);
+	unsigned long hash = 5381;
+	while(*str) {
+		hash = hash * 33 + (unsigned char)*str++;
 	}
+	return hash;
+}
 
-	if(!name || !name[0]) {
-		name = "(unnamed)";
+
+CTEST_SECTION static char *make_test_key(const char *file, int line, const char *name)
+{
+	char *key = ctest_malloc(strlen(file) + strlen(name) + 24);
+	sprintf(key, "%s:%d\t%s", file, line, name);
+	return key;
+}
+
+
+/** Returns the impact record with the given key.  If there is no
+ *  such record and create is true, a new empty record is created.
+ *  The key is copied if needed.
+ */
+
+CTEST_SECTION static struct impact_record *find_impact_record(const char *key, int create)
+{
+	struct impact_record **bucket;
+	struct impact_record *rec;
+
+	if(!impact_table) {
+		impact_table = calloc(IMPACT_TABLE_SIZE, sizeof(*impact_table));
+		if(!impact_table) {
+			fprintf(ctest_stderr(), "Out of memory allocating impact table!\n");
+			exit(239);
+		}
 	}
 
-	test->name = name;
-	test->finished = 0;
-	test->inverted = 0;
+	bucket = &impact_table[hash_string(key) % IMPACT_TABLE_SIZE];
+	for(rec = *bucket; rec; rec = rec->next) {
+		if(strcmp(rec->key, key) == 0) {
+			return rec;
+		}
+	}
 
-	metrics.tests_run += 1;
-	if(ctest_preferences.verbosity >= 1) {
-		print_test_indentation();
-		printf("%d. Running %s at %s:%d%s\n",
-			metrics.tests_run, name, file, line,
-			ctest_preferences.verbosity >= 2 ? " {" : "");
+	if(!create) {
+		return NULL;
 	}
 
-	test_push(test);
-	return &test_head->jmp;
+	rec = ctest_malloc(sizeof(struct impact_record));
+	rec->key = ctest_strdup(key);
+	rec->files = NULL;
+	rec->files_count = 0;
+	rec->files_size = 0;
+	rec->fresh = 0;
+	rec->affected = 0;
+	rec->serial = 0;
+	rec->next = *bucket;
+	*bucket = rec;
+	rec->list_next = NULL;
+	*impact_list_tail = rec;
+	impact_list_tail = &rec->list_next;
+	return rec;
 }
 
 
-int ctest_internal_finish_test(int success)
+CTEST_SECTION static void impact_record_add_file(struct impact_record *rec, const char *file)
 {
-	if(!test_head) {
-		/* how could we end up here without a test_head?? */
-		fprintf(stderr, "Internal finish error: somehow ctest_start didn't complete?\n");
-		exit(243);
+	int i;
+
+	for(i=0; i<rec->files_count; i++) {
+		if(strcmp(rec->files[i], file) == 0) {
+			return;
+		}
 	}
 
-	if(!test_head->finished) {
-		/* we haven't run the test yet, so run it. */
-		test_head->finished = 1;
-		return 1;
+	if(rec->files_count >= rec->files_size) {
+		rec->files_size = rec->files_size ? rec->files_size * 2 : 4;
+		rec->files = ctest_realloc(rec->files, rec->files_size * sizeof(char*));
 	}
+	rec->files[rec->files_count++] = ctest_strdup(file);
+}
 
-	if(success || test_head->inverted) {
-		metrics.test_successes += 1;
-	} else {
-		metrics.test_failures += 1;
+
+/** Returns true if a and b name the same file.  Paths may differ in
+ *  how much of the leading directory they include, so "src/foo.c"
+ *  matches "foo.c" and "/home/me/proj/src/foo.c".
+ */
+
+CTEST_SECTION static int same_source_file(const char *a, const char *b)
+{
+	size_t alen, blen;
+	const char *tmp;
+
+	while(a[0] == '.' && a[1] == '/') a += 2;
+	while(b[0] == '.' && b[1] == '/') b += 2;
+
+	alen = strlen(a);
+	blen = strlen(b);
+	if(alen < blen) {
+		tmp = a; a = b; b = tmp;
+		alen = strlen(a);
+		blen = strlen(b);
 	}
 
-	test_pop();
+	if(alen == blen) {
+		return strcmp(a, b) == 0;
+	}
+	return a[alen-blen-1] == '/' && strcmp(a+alen-blen, b) == 0;
+}
 
-	if(ctest_preferences.verbosity >= 2) {
-		print_test_indentation();
-		printf("}\n");
+
+/** Returns true if file is one of the files listed in ::ctest_preferences.changed. */
+
+CTEST_SECTION static int file_was_changed(const char *file)
+{
+	const char *start = ctest_preferences.changed;
+	const char *end;
+	char name[BUFSIZ];
+	size_t len;
+
+	while(start && *start) {
+		end = strchr(start, ',');
+		len = end ? (size_t)(end - start) : strlen(start);
+		if(len > 0 && len < sizeof(name)) {
+			memcpy(name, start, len);
+			name[len] = '\0';
+			if(same_source_file(name, file)) {
+				return 1;
+			}
+		}
+		start = end ? end + 1 : NULL;
 	}
 
 	return 0;
 }
 
 
-void print_ctest_results()
+/** Reads the impact index named by ::ctest_preferences.impact_index.
+ *  A missing index is not an error: every test will simply be run.
+ */
+
+CTEST_SECTION static void load_impact_index()
 {
-	if(metrics.test_failures == 0) {
-		printf("All OK.  %d test%s run, %d successe%s (%d assertion%s).\n",
-			metrics.tests_run, (metrics.tests_run == 1 ? "" : "s"),
-			metrics.test_successes, (metrics.test_successes == 1 ? "" : "s"),
-			metrics.assertions_run, (metrics.assertions_run == 1 ? "" : "s"));
-	} else {
-		printf("ERROR: %d failure%s in %d test%s run!\n",
-			metrics.test_failures, (metrics.test_failures == 1 ? "" : "s"),
-			metrics.tests_run, (metrics.tests_run == 1 ? "" : "s"));
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	char *name, *dep, *next;
+	struct impact_record *rec;
+
+	impact_loaded = 1;
+	fp = fopen(ctest_preferences.impact_index, "r");
+	if(!fp) {
+		return;
+	}
+
+	while(read_line(fp, &buf, &size)) {
+		if(buf[0] == '#' || !(name = strchr(buf, '\t'))) {
+			continue;
+		}
+		dep = strchr(name+1, '\t');
+		if(dep) {
+			*dep++ = '\0';
+		}
+
+		rec = find_impact_record(buf, 1);
+		for(; dep; dep = next) {
+			next = strchr(dep, '\t');
+			if(next) {
+				*next++ = '\0';
+			}
+			if(*dep) {
+				impact_record_add_file(rec, dep);
+				if(file_was_changed(dep)) {
+					rec->affected = 1;
+				}
+			}
+		}
 	}
+
+	free(buf);
+	fclose(fp);
 }
 
 
-/** You should have already run all tests.  This call will print their
- * results (print_ctest_results()) and exit with the number of tests
- * that failed as the error code (up to 100).
+/** Returns true if the test should be skipped because the impact index
+ *  says that it doesn't depend on any of the changed files.  Tests that
+ *  aren't in the index yet are always run.
  */
 
-void ctest_exit()
+CTEST_SECTION static int test_is_unaffected(const char *file, int line, const char *name)
 {
-	print_ctest_results();
-	exit(metrics.test_failures < 100 ? metrics.test_failures : 100);
+	struct impact_record *rec;
+	char *key;
+
+	if(!ctest_preferences.changed || !ctest_preferences.impact_index) {
+		return 0;
+	}
+	if(!impact_loaded) {
+		load_impact_index();
+	}
+
+	key = make_test_key(file, line, name);
+	rec = find_impact_record(key, 0);
+	free(key);
+
+	return rec && !rec->affected && !file_was_changed(file);
 }
 
 
-/** Normally, a failed assert causes the currently running test to be aborted.
- *  But how do unit tests test their assert macros?  Invert the sense.
- *  That way, if the assertion fails, that's what we expected, and the
- *  test actually succeeds.  To start or stop inverting, call this routine.
+/** Notes that the given test depends on the given source file.
+ *  The file must be a string that lives as long as the test (__FILE__).
  */
-int ctest_toggle_inversion()
+
+CTEST_SECTION static void record_source_file(struct test *test, const char *file)
 {
-	if(!test_head) {
-		fprintf(stderr, "Called ctest_toggle_inversion without having started a test!\n");
-		exit(240);
+	int i;
+
+	for(i=test->files_count-1; i>=0; i--) {
+		if(test->files[i] == file || strcmp(test->files[i], file) == 0) {
+			return;
+		}
 	}
-	test_head->inverted = !test_head->inverted;
-	return test_head->inverted;
+
+	if(test->files_count >= test->files_size) {
+		test->files_size = test->files_size ? test->files_size * 2 : 4;
+		test->files = ctest_realloc(test->files, test->files_size * sizeof(char*));
+	}
+	test->files[test->files_count++] = file;
 }
 
 
-/** Parses command-line arguments into ctest_preferences.
- *
- * Intended to be called before your application's command-line handling.
+/** Returns the record with the given key, emptied of any stale
+ *  dependencies read from the old index, ready to be recorded. */
+
+CTEST_SECTION static struct impact_record *refresh_impact_record(const char *key)
+{
+	struct impact_record *rec = find_impact_record(key, 1);
+	int i;
+
+	if(!rec->fresh) {
+		for(i=0; i<rec->files_count; i++) {
+			free(rec->files[i]);
+		}
+		rec->files_count = 0;
+		rec->fresh = 1;
+	}
+	rec->serial = ++impact_serial;
+	return rec;
+}
+
+
+/** Called when a test finishes.  Stores the test's dependencies in the
+ *  index and passes them on to the enclosing test, since skipping the
+ *  enclosing test would skip this test too.
+ */
+
+CTEST_SECTION static void record_test_impact(struct test *test)
+{
+	struct impact_record *rec;
+	char *key;
+	int i;
+
+	key = make_test_key(test->file, test->line, test->name);
+	rec = refresh_impact_record(key);
+	free(key);
+
+	for(i=0; i<test->files_count; i++) {
+		impact_record_add_file(rec, test->files[i]);
+		if(test->next) {
+			record_source_file(test->next, test->files[i]);
+		}
+	}
+}
+
+
+/** Writes the impact index.  Tests that were skipped during this run
+ *  keep the dependencies that were read from the old index.  If no test
+ *  was skipped, a test that's in the old index but didn't run was moved
+ *  or deleted, so it's dropped.
+ */
+
+CTEST_SECTION static void write_impact_index()
+{
+	FILE *fp;
+	struct impact_record *rec;
+	int full_run = metrics.tests_skipped == 0;
+	int i;
+
+	if(!impact_list_head) {
+		return;
+	}
+
+	fp = fopen(ctest_preferences.impact_index, "w");
+	if(!fp) {
+		fprintf(ctest_stderr(), "Could not write impact index %s!\n", ctest_preferences.impact_index);
+		return;
+	}
+
+	fprintf(fp, "# ctest impact index: file:line, test name, source files\n");
+	for(rec = impact_list_head; rec; rec = rec->list_next) {
+		if(full_run && !rec->fresh) {
+			continue;
+		}
+		fputs(rec->key, fp);
+		for(i=0; i<rec->files_count; i++) {
+			fprintf(fp, "\t%s", rec->files[i]);
+		}
+		fputc('\n', fp);
+	}
+
+	fclose(fp);
+}
+
+
+/*
+ *  Result files
  *
- * Returns true if the user specified that unit tests should be run,
- * false if not.  Feel free to ignore the function result and implement
- * your own way of deciding whether or not to run the tests.
+ *  When ::ctest_preferences.results is set, a machine-readable line is
+ *  appended to the result file as each test finishes, and a summary is
+ *  written by ctest_exit().  ctest-merge combines any number of these.
+ *  Each line is tab-separated:
+ *      test  STATUS  SECONDS  file:line  path
+ *      summary  TESTS  SUCCESSES  FAILURES  ASSERTIONS  SKIPPED  FLAKY
+ *  STATUS is ok, fail, flaky, crash or skip.  If a process dies before ctest_exit,
+ *  its result file won't have a summary line.
+ */
+
+static FILE *results_fp;
+
+
+CTEST_SECTION static FILE *results_file()
+{
+	if(!results_fp) {
+		results_fp = fopen(ctest_preferences.results, "w");
+		if(!results_fp) {
+			fprintf(ctest_stderr(), "Could not open result file %s!\n", ctest_preferences.results);
+			exit(241);
+		}
+		fprintf(results_fp, "# ctest results\n");
+	}
+	return results_fp;
+}
+
+
+CTEST_SECTION static void write_test_result(FILE *fp, struct test *test, const char *status, double seconds)
+{
+	fprintf(fp, "test\t%s\t%.6f\t%s:%d\t", status, seconds, test->file, test->line);
+	write_test_path(fp, test);
+	fputc('\n', fp);
+}
+
+
+CTEST_SECTION static void write_results_summary(FILE *fp)
+{
+	fprintf(fp, "summary\t%d\t%d\t%d\t%d\t%d\t%d\n",
+		metrics.tests_run, metrics.test_successes, metrics.test_failures,
+		metrics.assertions_run, metrics.tests_skipped, metrics.tests_flaky);
+}
+
+
+/*
+ *  Run history
  *
- * Arguments:
- *  * --ctest, --run-unit-tests: run unit tests and exit instead of starting the app.
- *  * -v: be more verbose.  Specify multiple to increase the verbosity.
- *  * --show-failures: print the output when inverted tests fail.
- *        Allows you to see ctest's output for failing tests.
+ *  When ::ctest_preferences.history is set, ctest_exit() remembers how
+ *  long this run took so the next run can estimate how long it has left,
+ *  and how long each top-level test took and how often it failed:
+ *      run  TESTS  SECONDS
+ *      test  RUNS  FAILURE_RATE  SECONDS  file:line  name
+ *  The rate and seconds are averages of the last HISTORY_WINDOW runs
+ *  (roughly: older runs fade out) so they follow the tests as they change.
  *
- * NOTE: this routine does not display any errors.  If you mis-type, the
- * argument will be silently ignored.
+ *  --time-budget uses them to pick the tests most likely to catch a
+ *  failure for the time they take.  Tests can't be reordered, they run
+ *  when the code reaches their ctest_start, but the ones that don't fit
+ *  are skipped.  Tests with no history are always run while there's
+ *  time left, new tests are the ones most likely to fail.  Skipping a
+ *  test forgets one of its runs, so no test is skipped forever.
+ */
+
+#define HISTORY_WINDOW 20
+#define HISTORY_TABLE_SIZE 1024
+
+struct history_record {
+	/** used to chain records in the same ::history table bucket. */
+	struct history_record *next;
+	/** used to keep the records in the order they were created. */
+	struct history_record *list_next;
+	/** "file:line\tname" of the ctest_start that began this test. */
+	char *key;
+	/** how many runs the averages cover, at most HISTORY_WINDOW. */
+	int runs;
+	double failure_rate;
+	double seconds;
+	/** true if --time-budget picked this test to run. */
+	int selected;
+};
+
+static struct {
+	/** true once the history file has been read. */
+	int loaded;
+	/** the number of tests run and the duration of the previous run, or 0 if unknown. */
+	int tests_run;
+	double seconds;
+	struct history_record **table;
+	struct history_record *list_head, **list_tail;
+	int count;
+	/** true once the tests have been picked for --time-budget. */
+	int budgeted;
+	/** the tests skipped by --time-budget and how long they'd have taken. */
+	int budget_skipped;
+	double budget_skipped_seconds;
+} history;
+
+/** the ctest_now() time when the first test or assert was run. */
+static double run_start_time;
+
+
+/** Returns the history record with the given key.  If there is no
+ *  such record and create is true, a new empty record is created.
+ *  The key is copied if needed.
  */
 
-int ctest_read_args(int argc, char **argv)
+CTEST_SECTION static struct history_record *find_history_record(const char *key, int create)
 {
-	char *curarg;
-	int return_value = 0;
+	struct history_record **bucket;
+	struct history_record *rec;
 
-	/* Don't use getopt because it's not on very many platforms.
-	 * Just do something super-simple.
-	 */
-	while(argc--) {
-		curarg = *argv++;
+	if(!history.table) {
+		history.table = calloc(HISTORY_TABLE_SIZE, sizeof(*history.table));
+		if(!history.table) {
+			fprintf(ctest_stderr(), "Out of memory allocating history table!\n");
+			exit(239);
+		}
+		history.list_tail = &history.list_head;
+	}
 
-		if(strcmp(curarg, "--ctest") == 0 ||
-		   strcmp(curarg, "--run-unit-tests") == 0) {
-			return_value = 1;
-		} else if(strcmp(curarg, "--show-failures") == 0) {
-			ctest_preferences.show_failures = 1;
-		} else if(*curarg == '-') {
-			switch(*++curarg) {
-			case 'v':
-				while(*curarg++ == 'v')
-					ctest_preferences.verbosity += 1;
-				break;
-			default: ; /* do nothing */
+	bucket = &history.table[hash_string(key) % HISTORY_TABLE_SIZE];
+	for(rec = *bucket; rec; rec = rec->next) {
+		if(strcmp(rec->key, key) == 0) {
+			return rec;
+		}
+	}
+	if(!create) {
+		return NULL;
+	}
+
+	rec = ctest_malloc(sizeof(struct history_record));
+	rec->key = ctest_strdup(key);
+	rec->runs = 0;
+	rec->failure_rate = 0;
+	rec->seconds = 0;
+	rec->selected = 0;
+	rec->next = *bucket;
+	*bucket = rec;
+	rec->list_next = NULL;
+	*history.list_tail = rec;
+	history.list_tail = &rec->list_next;
+	history.count += 1;
+	return rec;
+}
+
+
+CTEST_SECTION static void load_history()
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	char *key;
+	struct history_record *rec;
+	int runs, n;
+	double rate, seconds;
+
+	history.loaded = 1;
+	fp = fopen(ctest_preferences.history, "r");
+	if(!fp) {
+		return;
+	}
+
+	while(read_line(fp, &buf, &size)) {
+		if(strncmp(buf, "run\t", 4) == 0) {
+			sscanf(buf+4, "%d %lf", &history.tests_run, &history.seconds);
+		} else if(strncmp(buf, "test\t", 5) == 0 &&
+			sscanf(buf+5, "%d %lf %lf%n", &runs, &rate, &seconds, &n) == 3 && buf[5+n] == '\t') {
+			key = buf + 5 + n + 1;
+			if(strchr(key, '\t')) {
+				rec = find_history_record(key, 1);
+				rec->runs = runs < HISTORY_WINDOW ? runs : HISTORY_WINDOW;
+				rec->failure_rate = rate;
+				rec->seconds = seconds;
+			}
+		}
+	}
+
+	free(buf);
+	fclose(fp);
+}
+
+
+/** Adds the top-level test that just finished to its history. */
+
+CTEST_SECTION static void record_test_history(struct test *test, int success)
+{
+	struct history_record *rec;
+	char *key;
+
+	if(!history.loaded) {
+		load_history();
+	}
+
+	key = make_test_key(test->file, test->line, test->name);
+	rec = find_history_record(key, 1);
+	free(key);
+
+	if(rec->runs < HISTORY_WINDOW) {
+		rec->runs += 1;
+	}
+	rec->failure_rate += ((success ? 0.0 : 1.0) - rec->failure_rate) / rec->runs;
+	rec->seconds += (ctest_now() - test->start_time - rec->seconds) / rec->runs;
+}
+
+
+CTEST_SECTION static void write_history()
+{
+	FILE *fp;
+	struct history_record *rec;
+
+	if(!history.loaded) {
+		/* keep the records of the tests that didn't run */
+		load_history();
+	}
+
+	fp = fopen(ctest_preferences.history, "w");
+	if(!fp) {
+		fprintf(ctest_stderr(), "Could not write history file %s!\n", ctest_preferences.history);
+		return;
+	}
+
+	fprintf(fp, "# ctest history\n");
+	fprintf(fp, "run\t%d\t%.6f\n", metrics.tests_run, ctest_now() - run_start_time);
+	for(rec = history.list_head; rec; rec = rec->list_next) {
+		fprintf(fp, "test\t%d\t%.4f\t%.6f\t%s\n", rec->runs, rec->failure_rate, rec->seconds, rec->key);
+	}
+	fclose(fp);
+}
+
+
+/** How likely a test is to catch a failure per second it takes.  The
+ *  failure rate is smoothed so a test that has only passed a few times
+ *  is still worth more than one that has passed hundreds of times. */
+
+CTEST_SECTION static double history_value(const struct history_record *rec)
+{
+	double chance = (rec->failure_rate * rec->runs + 1) / (rec->runs + 2);
+	return chance / (rec->seconds > 1e-6 ? rec->seconds : 1e-6);
+}
+
+
+CTEST_SECTION static int compare_history_value(const void *a, const void *b)
+{
+	double va = history_value(*(struct history_record* const*)a);
+	double vb = history_value(*(struct history_record* const*)b);
+	return va > vb ? -1 : va < vb ? 1 : 0;
+}
+
+
+/** Picks the most valuable tests whose times add up to no more than
+ *  the budget.  That's a knapsack problem, taking them greedily in order
+ *  of value per second gets close enough. */
+
+CTEST_SECTION static void select_budgeted_tests()
+{
+	struct history_record **records;
+	struct history_record *rec;
+	double total = 0;
+	int i = 0;
+
+	history.budgeted = 1;
+	if(!history.loaded) {
+		load_history();
+	}
+	if(!history.count) {
+		return;
+	}
+
+	records = ctest_malloc(history.count * sizeof(*records));
+	for(rec = history.list_head; rec; rec = rec->list_next) {
+		records[i++] = rec;
+	}
+	qsort(records, history.count, sizeof(*records), compare_history_value);
+	for(i=0; i<history.count; i++) {
+		if(total + records[i]->seconds <= ctest_preferences.time_budget) {
+			records[i]->selected = 1;
+			total += records[i]->seconds;
+		}
+	}
+	free(records);
+}
+
+
+/** Returns true if the top-level test about to start should be skipped
+ *  to stay within ::ctest_preferences.time_budget. */
+
+CTEST_SECTION static int test_is_over_budget(const char *file, int line, const char *name)
+{
+	struct history_record *rec;
+	double elapsed;
+	char *key;
+
+	if(ctest_preferences.time_budget <= 0 || test_head) {
+		return 0;
+	}
+	if(!history.budgeted) {
+		select_budgeted_tests();
+	}
+
+	key = make_test_key(file, line, name);
+	rec = find_history_record(key, 0);
+	free(key);
+
+	/* if earlier tests ran long, skip the ones that no longer fit */
+	elapsed = ctest_now() - run_start_time;
+	if(rec ? rec->selected && elapsed + rec->seconds <= ctest_preferences.time_budget
+		: elapsed < ctest_preferences.time_budget) {
+		return 0;
+	}
+
+	history.budget_skipped += 1;
+	if(rec) {
+		history.budget_skipped_seconds += rec->seconds;
+		/* forget a little so a test that keeps getting skipped
+		 * eventually looks uncertain enough to be worth running */
+		if(rec->runs > 0) {
+			rec->runs -= 1;
+		}
+	}
+	return 1;
+}
+
+
+/*
+ *  Progress line
+ *
+ *  Long runs at verbosity 0 are silent until the very end.  When
+ *  ::ctest_preferences.progress is set, a status line is redrawn at most
+ *  every PROGRESS_INTERVAL seconds.  Reading the clock on every assert
+ *  would be too expensive so asserts just count down ::progress_countdown
+ *  and the clock is only checked when it reaches zero.  The countdown is
+ *  adjusted so the clock gets checked roughly every PROGRESS_CHECK seconds.
+ */
+
+#define PROGRESS_INTERVAL 0.1
+#define PROGRESS_CHECK 0.01
+
+static long progress_countdown = 1;
+static long progress_check_every = 1;
+static double progress_last_check, progress_last_draw;
+static int progress_last_assertions;
+/** the length of the progress line currently on the screen, 0 if none. */
+static int progress_drawn;
+
+
+CTEST_SECTION static void append_string(char *buf, size_t size, size_t *len, const char *str)
+{
+	while(*str && *len + 1 < size) {
+		buf[(*len)++] = *str++;
+	}
+	buf[*len] = '\0';
+}
+
+
+/** Like write_test_path() but into a fixed-size buffer.  Long paths are truncated. */
+
+CTEST_SECTION static void append_test_path(char *buf, size_t size, size_t *len, struct test *test)
+{
+	if(test->next) {
+		append_test_path(buf, size, len, test->next);
+		append_string(buf, size, len, "/");
+	}
+	append_string(buf, size, len, test->name);
+}
+
+
+/** Erases the progress line so something else can be printed. */
+
+CTEST_SECTION static void clear_progress()
+{
+	if(progress_drawn) {
+		fprintf(ctest_stdout(), "\r%*s\r", progress_drawn, "");
+		fflush(ctest_stdout());
+		progress_drawn = 0;
+	}
+}
+
+
+CTEST_SECTION static void draw_progress(double now)
+{
+	char line[BUFSIZ];
+	char eta[32];
+	size_t len, width = 80;
+	int done = metrics.test_successes + metrics.test_failures;
+	double elapsed = now - run_start_time;
+	double rate, fraction, remaining;
+	const char *columns = getenv("COLUMNS");
+
+	if(columns && atoi(columns) > 0 && (size_t)atoi(columns) < sizeof(line)) {
+		width = atoi(columns);
+	}
+
+	rate = (metrics.assertions_run - progress_last_assertions) / (now - progress_last_draw);
+	progress_last_assertions = metrics.assertions_run;
+
+	eta[0] = '\0';
+	if(!history.loaded && ctest_preferences.history) {
+		load_history();
+	}
+	if(history.tests_run > 0 && history.seconds > 0) {
+		fraction = (double)done / history.tests_run;
+		if(fraction > 0 && fraction < 1) {
+			remaining = elapsed * (1 - fraction) / fraction;
+		} else {
+			remaining = history.seconds - elapsed;
+		}
+		if(remaining < 0) {
+			remaining = 0;
+		}
+		sprintf(eta, ", ETA %d:%02d", (int)remaining / 60, (int)remaining % 60);
+	}
+
+	sprintf(line, "[%d test%s, %.0f asserts/s%s] ", done, (done == 1 ? "" : "s"), rate, eta);
+	len = strlen(line);
+	if(test_head) {
+		append_test_path(line, width, &len, test_head);
+	}
+
+	fprintf(ctest_stdout(), "\r%s", line);
+	if((int)len < progress_drawn) {
+		fprintf(ctest_stdout(), "%*s", progress_drawn - (int)len, "");
+	}
+	fflush(ctest_stdout());
+	progress_drawn = len;
+	progress_last_draw = now;
+}
+
+
+/** Called whenever ::progress_countdown runs out. */
+
+CTEST_SECTION static void update_progress()
+{
+	double now = ctest_now();
+	double interval = now - progress_last_check;
+
+	if(ctest_preferences.verbosity > 0) {
+		progress_countdown = 0x7fffffff;
+		return;
+	}
+
+	/* aim to check the clock about every PROGRESS_CHECK seconds */
+	if(interval < PROGRESS_CHECK / 2 && progress_check_every < 0x1000000) {
+		progress_check_every *= 2;
+	} else if(interval > PROGRESS_CHECK * 2 && progress_check_every > 1) {
+		progress_check_every /= 2;
+	}
+	progress_countdown = progress_check_every;
+	progress_last_check = now;
+
+	if(now - progress_last_draw >= PROGRESS_INTERVAL) {
+		draw_progress(now);
+	}
+}
+
+
+CTEST_SECTION static void print_test_indentation()
+{
+	struct test *test;
+
+	for(test=test_head; test; test=test->next) {
+		fprintf(ctest_stdout(), "  ");
+	}
+}
+
+
+/*
+ *  Test selection
+ *
+ *  --only=FILE and --skip=FILE name tests by their paths, one per line,
+ *  the same paths that --results writes.  --only runs the listed tests,
+ *  the tests nested in them, and the tests that enclose them (otherwise
+ *  we'd never get to the nested ones).  --skip skips the listed tests.
+ *  ctest-watch uses them to run the tests that failed last time first.
+ *  Like the impact index, a missing file is treated as an empty list.
+ */
+
+struct test_list {
+	char **paths;
+	int count;
+	int size;
+	int loaded;
+	/** a hash table of indexes into paths, built by test_list_contains().
+	 *  Each bucket is the most recently indexed path that hashes to it,
+	 *  and chain[i] is the next one after paths[i], or -1. */
+	int *buckets;
+	int *chain;
+	int buckets_size;
+	/** the number of paths in the hash table. */
+	int indexed;
+};
+
+static struct test_list only_list, skip_list;
+
+
+CTEST_SECTION static void add_to_test_list(struct test_list *list, const char *path)
+{
+	if(list->count >= list->size) {
+		list->size = list->size ? list->size * 2 : 16;
+		list->paths = ctest_realloc(list->paths, list->size * sizeof(char*));
+	}
+	list->paths[list->count++] = ctest_strdup(path);
+}
+
+
+/** Removes the most recently added path. */
+
+CTEST_SECTION static void pop_test_list(struct test_list *list)
+{
+	int last = --list->count;
+
+	if(list->indexed > last) {
+		/* it was indexed last so it's first in its bucket */
+		list->buckets[hash_string(list->paths[last]) % list->buckets_size] = list->chain[last];
+		list->indexed = last;
+	}
+	free(list->paths[last]);
+}
+
+
+/** Adds the paths that were added since the last call to the hash
+ *  table, rebuilding it once the list has outgrown it. */
+
+CTEST_SECTION static void index_test_list(struct test_list *list)
+{
+	unsigned long bucket;
+	int i;
+
+	if(list->buckets_size < list->size) {
+		free(list->buckets);
+		free(list->chain);
+		list->buckets_size = list->size;
+		list->buckets = ctest_malloc(list->buckets_size * sizeof(int));
+		list->chain = ctest_malloc(list->buckets_size * sizeof(int));
+		for(i=0; i<list->buckets_size; i++) {
+			list->buckets[i] = -1;
+		}
+		list->indexed = 0;
+	}
+
+	for(; list->indexed < list->count; list->indexed++) {
+		bucket = hash_string(list->paths[list->indexed]) % list->buckets_size;
+		list->chain[list->indexed] = list->buckets[bucket];
+		list->buckets[bucket] = list->indexed;
+	}
+}
+
+
+CTEST_SECTION static int test_list_contains(struct test_list *list, const char *path)
+{
+	int i;
+
+	if(!list->count) {
+		return 0;
+	}
+	index_test_list(list);
+	for(i = list->buckets[hash_string(path) % list->buckets_size]; i >= 0; i = list->chain[i]) {
+		if(strcmp(path, list->paths[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+CTEST_SECTION static void load_test_list(struct test_list *list, const char *filename)
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+
+	list->loaded = 1;
+	fp = fopen(filename, "r");
+	if(!fp) {
+		return;
+	}
+
+	while(read_line(fp, &buf, &size)) {
+		if(buf[0]) {
+			add_to_test_list(list, buf);
+		}
+	}
+
+	free(buf);
+	fclose(fp);
+}
+
+
+/** Returns true if path is inside the test named by prefix. */
+
+CTEST_SECTION static int path_is_inside(const char *path, const char *prefix)
+{
+	size_t len = strlen(prefix);
+	return strncmp(path, prefix, len) == 0 && path[len] == '/';
+}
+
+
+/** Stores the path of the test about to be started in path. */
+
+CTEST_SECTION static void make_test_path(char *path, size_t size, const char *name)
+{
+	size_t len = 0;
+
+	path[0] = '\0';
+	if(test_head) {
+		append_test_path(path, size, &len, test_head);
+		append_string(path, size, &len, "/");
+	}
+	append_string(path, size, &len, name);
+}
+
+
+/** Returns false if the test about to be started shouldn't be run. */
+
+CTEST_SECTION static int test_is_selected(const char *name)
+{
+	char path[BUFSIZ];
+	int i;
+
+	if(!ctest_preferences.only && !ctest_preferences.skip) {
+		return 1;
+	}
+
+	make_test_path(path, sizeof(path), name);
+
+	if(ctest_preferences.skip) {
+		if(!skip_list.loaded) {
+			load_test_list(&skip_list, ctest_preferences.skip);
+		}
+		if(test_list_contains(&skip_list, path)) {
+			return 0;
+		}
+	}
+
+	if(ctest_preferences.only) {
+		if(!only_list.loaded) {
+			load_test_list(&only_list, ctest_preferences.only);
+		}
+		for(i=0; i<only_list.count; i++) {
+			if(strcmp(path, only_list.paths[i]) == 0 ||
+				path_is_inside(path, only_list.paths[i]) ||
+				path_is_inside(only_list.paths[i], path)) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ *  Checkpoints
+ *
+ *  When ::ctest_preferences.checkpoint is set, a line is appended to the
+ *  checkpoint file and flushed as each test starts and finishes, so the
+ *  file survives the process crashing or being killed.  The finish
+ *  lines are the same as a result file's:
+ *      start  file:line  path
+ *      test  STATUS  SECONDS  file:line  path
+ *      asserts  COUNT
+ *  An asserts line follows each finish line with the number of asserts
+ *  run since the previous one, so a run that dies doesn't take its
+ *  assert count with it.
+ *  Tests that finished in an earlier run with the same checkpoint file
+ *  are skipped.  An assert that fails outside of any test is recorded as
+ *  a failure of the test "(top level)".  The next run doesn't exit when
+ *  that assert fails again, it already has been reported.
+ *
+ *  --supervise uses this to resume a run that died (see supervise()).
+ */
+
+#define TOP_LEVEL "(top level)"
+
+static FILE *checkpoint_fp;
+/** the paths of the tests that finished in earlier runs. */
+static struct test_list checkpoint_done;
+/** the file:line of the asserts that failed outside of any test in earlier runs. */
+static struct test_list checkpoint_top_level;
+/** true in the child processes started by supervise(). */
+static int supervised;
+/** ::metrics.assertions_run as of the last asserts line. */
+static int checkpoint_asserts;
+
+
+CTEST_SECTION static FILE *checkpoint_file()
+{
+	if(!checkpoint_fp) {
+		checkpoint_fp = fopen(ctest_preferences.checkpoint, "a");
+		if(!checkpoint_fp) {
+			fprintf(ctest_stderr(), "Could not open checkpoint file %s!\n", ctest_preferences.checkpoint);
+			exit(241);
+		}
+	}
+	return checkpoint_fp;
+}
+
+
+/** Splits a test line from a result or checkpoint file in place.
+ *  Returns false if the line isn't a test line.
+ */
+
+CTEST_SECTION static int parse_test_line(char *line, char **status, char **location, char **path)
+{
+	char *tab;
+
+	if(strncmp(line, "test\t", 5) != 0) {
+		return 0;
+	}
+	*status = line + 5;
+	if(!(tab = strrchr(*status, '\t'))) {
+		return 0;
+	}
+	*tab = '\0';
+	*path = tab + 1;
+	if(!(tab = strrchr(*status, '\t'))) {
+		return 0;
+	}
+	*tab = '\0';
+	*location = tab + 1;
+	if((tab = strchr(*status, '\t'))) {
+		/* don't need the seconds */
+		*tab = '\0';
+	}
+	return 1;
+}
+
+
+CTEST_SECTION static void load_checkpoint()
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	char *status, *location, *path;
+
+	checkpoint_done.loaded = 1;
+	fp = fopen(ctest_preferences.checkpoint, "r");
+	if(!fp) {
+		return;
+	}
+
+	while(read_line(fp, &buf, &size)) {
+		if(!parse_test_line(buf, &status, &location, &path)) {
+			continue;
+		}
+		if(strcmp(path, TOP_LEVEL) == 0) {
+			add_to_test_list(&checkpoint_top_level, location);
+		} else {
+			add_to_test_list(&checkpoint_done, path);
+		}
+	}
+
+	free(buf);
+	fclose(fp);
+}
+
+
+/** Returns true if the test about to be started finished in an earlier run. */
+
+CTEST_SECTION static int test_is_resumed(const char *name)
+{
+	char path[BUFSIZ];
+
+	if(!ctest_preferences.checkpoint) {
+		return 0;
+	}
+	if(!checkpoint_done.loaded) {
+		load_checkpoint();
+	}
+
+	make_test_path(path, sizeof(path), name);
+	return test_list_contains(&checkpoint_done, path);
+}
+
+
+/** Writes the number of asserts run since the last asserts line. */
+
+CTEST_SECTION static void write_checkpoint_asserts()
+{
+	FILE *fp = checkpoint_file();
+
+	if(metrics.assertions_run != checkpoint_asserts) {
+		fprintf(fp, "asserts\t%d\n", metrics.assertions_run - checkpoint_asserts);
+		checkpoint_asserts = metrics.assertions_run;
+	}
+	fflush(fp);
+}
+
+
+CTEST_SECTION static void checkpoint_test_start(struct test *test)
+{
+	FILE *fp = checkpoint_file();
+
+	fprintf(fp, "start\t%s:%d\t", test->file, test->line);
+	write_test_path(fp, test);
+	fputc('\n', fp);
+	fflush(fp);
+}
+
+
+/** Writes a finished test to the result and checkpoint files. */
+
+CTEST_SECTION static void record_test_result(struct test *test, const char *status, double seconds)
+{
+	if(ctest_preferences.results) {
+		write_test_result(results_file(), test, status, seconds);
+	}
+	if(ctest_preferences.checkpoint && !test->resumed) {
+		write_test_result(checkpoint_file(), test, status, seconds);
+		write_checkpoint_asserts();
+	}
+}
+
+
+/** Called when an assert fails outside of any test.  Returns true if
+ *  the process should keep going because an earlier run recorded it.
+ */
+
+CTEST_SECTION static int resume_after_top_level_failure(const char *file, int line)
+{
+	char location[BUFSIZ];
+	FILE *fp;
+
+	if(!ctest_preferences.checkpoint) {
+		return 0;
+	}
+	if(!checkpoint_done.loaded) {
+		load_checkpoint();
+	}
+
+	sprintf(location, "%.*s:%d", (int)sizeof(location) - 32, file, line);
+	if(test_list_contains(&checkpoint_top_level, location)) {
+		return 1;
+	}
+
+	fp = checkpoint_file();
+	fprintf(fp, "test\tfail\t0.000000\t%s\t" TOP_LEVEL "\n", location);
+	write_checkpoint_asserts();
+	return 0;
+}
+
+
+/*
+ *  Batched asserts
+ *
+ *  Batch asserts don't call ctest_assert when they pass, they just
+ *  increment ::ctest_batch_passes.  flush_batch() adds those to the
+ *  metrics.  It's called at the end of every ctest_batch block and
+ *  before every regular assert, so counts and assert numbers stay in
+ *  order even when a failed batch assert longjmps out of the block.
+ */
+
+long ctest_batch_passes;
+int ctest_batch_open;
+int ctest_fast_asserts = 1;
+/** where the most recent ctest_batch block started. */
+static const char *batch_file = "(batch)";
+static int batch_line;
+
+
+CTEST_SECTION static void flush_batch()
+{
+	long passes = ctest_batch_passes;
+	ctest_batch_passes = 0;
+
+	metrics.assertions_run += passes;
+	if(ctest_preferences.progress) {
+		progress_countdown -= passes;
+		if(progress_countdown <= 0) {
+			update_progress();
+		}
+	}
+	if(ctest_preferences.impact_index && test_head) {
+		record_source_file(test_head, batch_file);
+	}
+
+	if(test_head && test_head->inverted) {
+		/* When inverted, every one of those passes was a failure. */
+		clear_progress();
+		fprintf(ctest_stderr(), "%s:%d: %ld inverted batched assert%s not expected to succeed!\n",
+			batch_file, batch_line, passes, (passes == 1 ? " was" : "s were"));
+		longjmp(test_head->jmp.jmp, 1);
+	}
+
+	if(ctest_preferences.verbosity >= 2) {
+		print_test_indentation();
+		fprintf(ctest_stdout(), "%d. batch of %ld assert%s at %s:%d: success\n",
+			metrics.assertions_run, passes, (passes == 1 ? "" : "s"),
+			batch_file, batch_line);
+	}
+}
+
+
+/** Passing asserts may skip ctest_assert and just bump ::ctest_batch_passes
+ *  unless something needs to see every one of them.  Called whenever
+ *  one of those things might have changed.
+ */
+
+CTEST_SECTION static void update_fast_asserts()
+{
+	ctest_fast_asserts = !(ctest_preferences.verbosity >= 2 ||
+		ctest_preferences.impact_index ||
+		(test_head && test_head->inverted));
+}
+
+
+CTEST_SECTION int ctest_internal_batch_begin(const char *file, int line)
+{
+	/* the batch counter is shared, the workers would race on it */
+	if(ctest_internal_threads) {
+		ctest_assert(0, file, line, "ctest_batch can't be used in a ctest_stress body");
+	}
+	if(ctest_batch_passes) {
+		flush_batch();
+	}
+	batch_file = file;
+	batch_line = line;
+	return 1;
+}
+
+
+CTEST_SECTION int ctest_internal_batch_end()
+{
+	if(ctest_batch_passes) {
+		flush_batch();
+	}
+	return 0;
+}
+
+
+/** Does all of ctest_assert's work except aborting the test.
+ *  Returns true if the assert failed and the test should be aborted.
+ *  This lets callers that can't longjmp, like ctest.hpp's
+ *  exception-based tests, unwind in their own way.
+ */
+
+CTEST_SECTION int ctest_internal_check(int success, const char *file, int line, const char *msg)
+{
+	if(ctest_batch_passes) {
+		flush_batch();
+	}
+#ifdef CTEST_PROFILER
+	check_profile();
+#endif
+
+	if(test_head && test_head->inverted)
+		success = !success;
+
+	if(ctest_preferences.progress && --progress_countdown <= 0) {
+		update_progress();
+	}
+
+	if(!success || (ctest_preferences.show_failures && test_head && test_head->inverted)) {
+		clear_progress();
+		fprintf(ctest_stderr(), "%s:%d: assert failed: %s!\n", file, line, msg);
+	}
+
+	if(ctest_preferences.impact_index && test_head) {
+		record_source_file(test_head, file);
+	}
+
+	metrics.assertions_run += 1;
+	if(success) {
+		if(ctest_preferences.verbosity >= 2) {
+			print_test_indentation();
+			fprintf(ctest_stdout(), "%d. %sassert %s at %s:%d: success\n",
+				metrics.assertions_run,
+				test_head && test_head->inverted ? "inverted " : "",
+				msg, file, line);
+		}
+		return 0;
+	}
+
+	if(test_head && test_head->inverted) {
+		fprintf(ctest_stderr(), "%s:%d: inverted assert was not expected to succeed: %s!\n", file, line, msg);
+	}
+	return 1;
+}
+
+
+struct ctest_internal_threads *ctest_internal_threads;
+
+
+/** Called when an assert in the innermost test fails.  Returns true if
+ *  the test should keep going because it's collecting its failures
+ *  (see ctest_soft_asserts()), false if it should be stopped.
+ */
+
+CTEST_SECTION int ctest_internal_soft_failure()
+{
+	if(!test_head || test_head->soft_max <= 0) {
+		return 0;
+	}
+
+	test_head->soft_failures += 1;
+	if(test_head->soft_failures < test_head->soft_max) {
+		return 1;
+	}
+
+	clear_progress();
+	fprintf(ctest_stderr(), "%s:%d: test %s stopped after %d failed asserts.\n",
+		test_head->file, test_head->line, test_head->name, test_head->soft_failures);
+	return 0;
+}
+
+
+CTEST_SECTION void ctest_soft_asserts(int max)
+{
+	if(!test_head) {
+		fprintf(ctest_stderr(), "Called ctest_soft_asserts without having started a test!\n");
+		exit(240);
+	}
+	test_head->soft_max = max;
+}
+
+
+CTEST_SECTION void ctest_assert(int success, const char *file, int line, const char *msg)
+{
+	int failed;
+
+	if(ctest_internal_threads) {
+		if(success && ctest_internal_threads->pass()) {
+			return;
+		}
+		ctest_internal_threads->lock();
+		failed = ctest_internal_check(success, file, line, msg);
+		ctest_internal_threads->unlock();
+		if(failed) {
+			ctest_internal_threads->fail();
+		}
+		return;
+	}
+
+	if(ctest_internal_check(success, file, line, msg)) {
+		if(test_head) {
+			if(ctest_internal_soft_failure()) {
+				return;
+			}
+			/* longjump to abort this test */
+			longjmp(test_head->jmp.jmp, 1);
+		} else if(!resume_after_top_level_failure(file, line)) {
+			exit(1); /* 1 because a single test failed */
+		}
+	}
+}
+
+
+/** Returns the jump buffer of the innermost running test, or NULL. */
+
+CTEST_SECTION struct ctest_jmp_wrapper* ctest_internal_current_test()
+{
+	return test_head ? &test_head->jmp : NULL;
+}
+
+
+CTEST_SECTION void ctest_assert_fmt(int success, const char *file, int line, const char *msg, ...)
+{
+	va_list ap;
+	char buf[BUFSIZ];
+
+	va_start(ap, msg);
+	/* Thanks to awful standardization, I don't get to use vsnprintf.
+         * For now we have an extremely unlikely but potential buffer overflow.
+         * Longer term, should probably figure out how to get rid of varargs entirely. */
+	vsprintf(buf, msg, ap);
+	va_end(ap);
+
+	ctest_assert(success, file, line, buf);
+}
+
+
+/*
+ *  Assert sites
+ *
+ *  The macros in ctassert.h only call these when an assert fails or
+ *  when ::ctest_fast_asserts is off (verbose output, inverted tests and
+ *  so on).  A passing assert just counts itself in ::ctest_batch_passes.
+ *  Expressions and strings are cut short so the message always fits in
+ *  CTEST_MESSAGE_MAX, however big the values are.
+ *
+ *  When a string assert fails on strings too long to print whole, we
+ *  print where they first differ and a few characters either side:
+ *      a == b with a (80000 bytes) and b (80000 bytes) differing at offset 70000, line 812 column 17:
+ *          a: ..."ount": 12, "name": "spline"...
+ *                            ^
+ *          b: ..."ount": 13, "name": "spline"...
+ *  With --diff, strings that contain newlines also get a unified diff
+ *  of the lines that differ, cut short at DIFF_LINES lines.
+ */
+
+#define SITE_EXPR_MAX 512
+#define SITE_STRING_MAX 2048
+/** strings longer than this, or with newlines, are shown in a window. */
+#define SITE_SHORT_STRING 64
+/** how many characters to show either side of the first difference. */
+#define SITE_WINDOW 32
+#define DIFF_CONTEXT 3
+#define DIFF_LINES 10
+#define DIFF_WIDTH 80
+
+/** A CTEST_SITE string taken apart. */
+struct site {
+	char format;
+	const char *file;
+	int line;
+	const char *x, *op, *y;
+};
+
+
+CTEST_SECTION static void parse_site(const char *file, const char *str, struct site *site)
+{
+	site->format = *str++;
+	site->file = file;
+	site->line = atoi(str);
+	site->x = str += strlen(str) + 1;
+	site->op = str += strlen(str) + 1;
+	site->y = str += strlen(str) + 1;
+	if(!site->y[0]) {
+		site->y = NULL;
+	}
+}
+
+
+/** Writes "x op y with x=" to buf, "x op 0 with x=" if there's no y.
+ *  Returns the end of the string. */
+
+CTEST_SECTION static char *site_prefix(char *buf, const struct site *site)
+{
+	return buf + sprintf(buf, "%.*s %.*s %.*s with %.*s=",
+		SITE_EXPR_MAX, site->x, SITE_EXPR_MAX, site->op,
+		SITE_EXPR_MAX, site->y ? site->y : "0", SITE_EXPR_MAX, site->x);
+}
+
+
+/** Writes " and y=" to buf.  Returns the end of the string. */
+
+CTEST_SECTION static char *site_and(char *buf, const struct site *site)
+{
+	return buf + sprintf(buf, " and %.*s=", SITE_EXPR_MAX, site->y);
+}
+
+
+CTEST_COLD void ctest_internal_assert_long(const char *file, const char *str, int success, long x, long y)
+{
+	struct site site;
+	char buf[CTEST_MESSAGE_MAX];
+	const char *fmt;
+	char *end;
+
+	parse_site(file, str, &site);
+	fmt = site.format == CTEST_SITE_HEX[0] ? "0x%lX" : "%ld";
+	end = site_prefix(buf, &site);
+	end += sprintf(end, fmt, x);
+	if(site.y) {
+		end = site_and(end, &site);
+		sprintf(end, fmt, y);
+	}
+	ctest_assert(success, site.file, site.line, buf);
+}
+
+
+CTEST_COLD void ctest_internal_assert_double(const char *file, const char *str, int success, double x, double y)
+{
+	struct site site;
+	char buf[CTEST_MESSAGE_MAX];
+	char *end;
+
+	parse_site(file, str, &site);
+	end = site_prefix(buf, &site);
+	end += sprintf(end, "%f", x);
+	if(site.y) {
+		end = site_and(end, &site);
+		sprintf(end, "%f", y);
+	}
+	ctest_assert(success, site.file, site.line, buf);
+}
+
+
+/** Can't use %p because some libcs print "0x" first and some don't. */
+
+CTEST_COLD void ctest_internal_assert_ptr(const char *file, const char *str, int success, void *x, void *y)
+{
+	struct site site;
+	char buf[CTEST_MESSAGE_MAX];
+	char *end;
+
+	parse_site(file, str, &site);
+	if(!site.y) {
+		sprintf(buf, "%.*s %.*s NULL with %.*s==0x%lX!", SITE_EXPR_MAX, site.x,
+			SITE_EXPR_MAX, site.op, SITE_EXPR_MAX, site.x, (unsigned long)x);
+	} else {
+		end = site_prefix(buf, &site);
+		end += sprintf(end, "0x%lX", (unsigned long)x);
+		end = site_and(end, &site);
+		sprintf(end, "0x%lX", (unsigned long)y);
+	}
+	ctest_assert(success, site.file, site.line, buf);
+}
+
+
+/** Writes len bytes of str to out with C escapes for the unprintable
+ *  characters, and for quotes and backslashes if quote is set.  Writes
+ *  at most 4*len characters plus a terminator.  Returns the end of the
+ *  string. */
+
+CTEST_SECTION static char *escape_string(char *out, const char *str, size_t len, int quote)
+{
+	const unsigned char *ptr = (const unsigned char*)str;
+	const unsigned char *end = ptr + len;
+
+	for(; ptr < end; ptr++) {
+		switch(*ptr) {
+		case '\n': *out++ = '\\'; *out++ = 'n'; break;
+		case '\r': *out++ = '\\'; *out++ = 'r'; break;
+		case '\t': *out++ = '\\'; *out++ = 't'; break;
+		default:
+			if(quote && (*ptr == '"' || *ptr == '\\')) {
+				*out++ = '\\';
+				*out++ = *ptr;
+			} else if(*ptr < 32 || *ptr == 127) {
+				out += sprintf(out, "\\x%02X", *ptr);
+			} else {
+				*out++ = *ptr;
+			}
+		}
+	}
+
+	*out = '\0';
+	return out;
+}
+
+
+/** Returns the offset of the first byte where a and b differ, or the
+ *  length of the shorter one if it's a prefix of the other. */
+
+CTEST_SECTION static size_t first_difference(const char *a, size_t alen, const char *b, size_t blen)
+{
+	size_t len = alen < blen ? alen : blen;
+	size_t i = 0;
+
+	/* memcmp is much faster than a byte at a time on big strings */
+	while(i + 4096 <= len && memcmp(a + i, b + i, 4096) == 0) {
+		i += 4096;
+	}
+	while(i < len && a[i] == b[i]) {
+		i++;
+	}
+	return i;
+}
+
+
+/** Writes a line showing the characters of str around offset at.
+ *  Sets *caret to the column of the character at offset at. */
+
+CTEST_SECTION static char *string_window(char *out, const char *label, int width,
+	const char *str, size_t len, size_t at, int *caret)
+{
+	size_t start = at > SITE_WINDOW ? at - SITE_WINDOW : 0;
+	size_t end = len - at > SITE_WINDOW ? at + SITE_WINDOW : len;
+	char *line = out + 1;
+
+	out += sprintf(out, "\n    %-*.*s: %s\"", width, width, label, start > 0 ? "..." : "");
+	out = escape_string(out, str + start, at - start, 1);
+	*caret = (int)(out - line);
+	out = escape_string(out, str + at, end - at, 1);
+	out += sprintf(out, "\"%s", end < len ? "..." : "");
+	return out;
+}
+
+
+/** Returns the start of the line after the one that starts at line. */
+
+CTEST_SECTION static const char *next_line(const char *line, const char *end)
+{
+	const char *eol = memchr(line, '\n', end - line);
+	return eol ? eol + 1 : end;
+}
+
+
+/** Returns the start of the line before the one that starts at line. */
+
+CTEST_SECTION static const char *previous_line(const char *start, const char *line)
+{
+	if(line > start) {
+		line--;
+		while(line > start && line[-1] != '\n') {
+			line--;
+		}
+	}
+	return line;
+}
+
+
+CTEST_SECTION static unsigned long count_lines(const char *str, size_t len)
+{
+	unsigned long count = 0;
+	const char *end = str + len;
+
+	while(str < end) {
+		str = next_line(str, end);
+		count += 1;
+	}
+	return count;
+}
+
+
+/** Writes lines from line up to end, each prefixed with c, stopping
+ *  after max of them.  Returns the end of the string. */
+
+CTEST_SECTION static char *diff_lines(char *out, char c, const char *line, const char *end, unsigned long max)
+{
+	const char *next;
+	size_t len;
+	unsigned long count = 0;
+
+	for(; line < end; line = next) {
+		next = next_line(line, end);
+		if(count++ >= max) {
+			count = count_lines(line, end - line);
+			return out + sprintf(out, "\n%c... %lu more line%s", c, count, (count == 1 ? "" : "s"));
+		}
+		len = next - line;
+		if(len > 0 && line[len-1] == '\n') {
+			len -= 1;
+		}
+		*out++ = '\n';
+		*out++ = c;
+		out = escape_string(out, line, len < DIFF_WIDTH ? len : DIFF_WIDTH, 0);
+		if(len > DIFF_WIDTH) {
+			out += sprintf(out, "...");
+		}
+	}
+	return out;
+}
+
+
+/** Writes a unified diff of a and b, which are the same up to offset
+ *  at.  It's a single hunk: the lines between the common prefix and
+ *  the common suffix are removed from a and added from b.  That's not
+ *  always the smallest diff, but it takes linear time and it's always
+ *  correct. */
+
+CTEST_SECTION static char *unified_diff(char *out, const struct site *site,
+	const char *a, size_t alen, const char *b, size_t blen, size_t at, unsigned long line)
+{
+	size_t start = at, ia = alen, ib = blen;
+	const char *before, *after, *ptr;
+	unsigned long before_count = 0, after_count = 0, alines, blines;
+
+	/* the common suffix, but it mustn't overlap the common prefix */
+	while(ia > at && ib > at && a[ia-1] == b[ib-1]) {
+		ia--;
+		ib--;
+	}
+	/* move both ends to the start of a line */
+	while(start > 0 && a[start-1] != '\n') {
+		start--;
+	}
+	while(ia < alen && !((ia == start || a[ia-1] == '\n') && (ib == start || b[ib-1] == '\n'))) {
+		ia++;
+		ib++;
+	}
+
+	alines = count_lines(a + start, ia - start);
+	blines = count_lines(b + start, ib - start);
+	for(before = a + start; before_count < DIFF_CONTEXT && before > a; before_count++) {
+		before = previous_line(a, before);
+	}
+	for(ptr = after = a + ia; after_count < DIFF_CONTEXT && ptr < a + alen; after_count++) {
+		ptr = next_line(ptr, a + alen);
+	}
+
+	out += sprintf(out, "\n--- %.*s\n+++ %.*s\n@@ -%lu,%lu +%lu,%lu @@",
+		SITE_EXPR_MAX, site->x, SITE_EXPR_MAX, site->y,
+		line - before_count, before_count + alines + after_count,
+		line - before_count, before_count + blines + after_count);
+	out = diff_lines(out, ' ', before, a + start, DIFF_CONTEXT);
+	out = diff_lines(out, '-', a + start, a + ia, DIFF_LINES);
+	out = diff_lines(out, '+', b + start, b + ib, DIFF_LINES);
+	out = diff_lines(out, ' ', after, ptr, DIFF_CONTEXT);
+	return out;
+}
+
+
+/** Describes two strings that are too long to print whole. */
+
+CTEST_SECTION static void describe_strings(char *out, const struct site *site, const char *x, const char *y)
+{
+	size_t xlen = strlen(x), ylen = strlen(y);
+	size_t at = first_difference(x, xlen, y, ylen);
+	const char *ptr, *line_start = x;
+	unsigned long line = 1;
+	int width, caret, same;
+
+	for(ptr = x; (ptr = memchr(ptr, '\n', x + at - ptr)); ptr++) {
+		line += 1;
+		line_start = ptr + 1;
+	}
+
+	out += sprintf(out, "%.*s %.*s %.*s with ", SITE_EXPR_MAX, site->x,
+		SITE_EXPR_MAX, site->op, SITE_EXPR_MAX, site->y);
+	same = (at == xlen && at == ylen);
+	if(same) {
+		out += sprintf(out, "%.*s and %.*s the same %lu bytes:", SITE_EXPR_MAX, site->x,
+			SITE_EXPR_MAX, site->y, (unsigned long)xlen);
+		at = 0;
+	} else {
+		out += sprintf(out, "%.*s (%lu bytes) and %.*s (%lu bytes) differing at offset %lu, line %lu column %lu:",
+			SITE_EXPR_MAX, site->x, (unsigned long)xlen, SITE_EXPR_MAX, site->y, (unsigned long)ylen,
+			(unsigned long)at, line, (unsigned long)(x + at - line_start + 1));
+	}
+
+	width = (int)strlen(site->x) > (int)strlen(site->y) ? (int)strlen(site->x) : (int)strlen(site->y);
+	if(width > 32) {
+		width = 32;
+	}
+	out = string_window(out, site->x, width, x, xlen, at, &caret);
+	out += sprintf(out, "\n%*s^", caret, "");
+	out = string_window(out, site->y, width, y, ylen, at, &caret);
+
+	if(ctest_preferences.diff && !same &&
+		(memchr(x, '\n', xlen) || memchr(y, '\n', ylen))) {
+		unified_diff(out, site, x, xlen, y, ylen, at, line);
+	}
+}
+
+
+CTEST_COLD int ctest_internal_string_message(char *buf, const char *file, const char *str, const char *x, const char *y)
+{
+	struct site site;
+	char *end;
+
+	parse_site(file, str, &site);
+	if(strlen(x) > SITE_SHORT_STRING || strlen(y) > SITE_SHORT_STRING || strchr(x, '\n') || strchr(y, '\n')) {
+		describe_strings(buf, &site, x, y);
+	} else {
+		end = site_prefix(buf, &site);
+		end += sprintf(end, "\"%s\"", x);
+		end = site_and(end, &site);
+		sprintf(end, "\"%s\"", y);
+	}
+	return site.line;
+}
+
+
+CTEST_COLD void ctest_internal_assert_str(const char *file, const char *str, int success, const char *x, const char *y)
+{
+	char buf[CTEST_MESSAGE_MAX];
+	int line = ctest_internal_string_message(buf, file, str, x, y);
+	ctest_assert(success, file, line, buf);
+}
+
+
+/** The site's op is "empty" or "nonempty". */
+
+CTEST_COLD void ctest_internal_assert_empty(const char *file, const char *str, const char *x)
+{
+	struct site site;
+	char buf[CTEST_MESSAGE_MAX];
+	int empty, success;
+
+	parse_site(file, str, &site);
+	empty = strcmp(site.op, "empty") == 0;
+	if(!x) {
+		success = 0;
+		sprintf(buf, "%.*s is %s with %.*s set to NULL", SITE_EXPR_MAX, site.x,
+			site.op, SITE_EXPR_MAX, site.x);
+	} else if(empty == !x[0]) {
+		success = 1;
+		if(empty) {
+			sprintf(buf, "%.*s is empty with %.*s[0]=0", SITE_EXPR_MAX, site.x, SITE_EXPR_MAX, site.x);
+		} else {
+			/* sic, it's always said this */
+			sprintf(buf, "%.*s is empty with %.*s set to \"%.*s\"", SITE_EXPR_MAX, site.x,
+				SITE_EXPR_MAX, site.x, SITE_STRING_MAX, x);
+		}
+	} else {
+		success = 0;
+		if(empty) {
+			sprintf(buf, "%.*s is empty with %.*s set to \"%.*s\"", SITE_EXPR_MAX, site.x,
+				SITE_EXPR_MAX, site.x, SITE_STRING_MAX, x);
+		} else {
+			sprintf(buf, "%.*s is nonempty with %.*s[0] set to 0", SITE_EXPR_MAX, site.x, SITE_EXPR_MAX, site.x);
+		}
+	}
+	ctest_assert(success, site.file, site.line, buf);
+}
+
+
+/*
+ *  Memory accounting
+ *
+ *  When ::ctest_preferences.memory is set, or a test calls
+ *  ctest_memory_budget(), the test's memory usage is sampled when it
+ *  starts and when it finishes.  On Linux the kernel's peak RSS
+ *  (VmHWM) is reset at the start of every test so we see the peak
+ *  during the test, not the peak of the whole process.  Because nested
+ *  tests reset it too, each test folds the current peak into all of the
+ *  tests that enclose it before resetting.  Elsewhere getrusage's
+ *  lifetime peak is used, which only shows growth past the old peak.
+ */
+
+CTEST_SECTION static void sample_memory(struct memory_sample *sample)
+{
+	FILE *fp;
+	char line[256];
+#ifdef CTEST_POSIX
+	struct rusage usage;
+#endif
+
+	sample->rss = 0;
+	sample->peak = 0;
+	sample->major_faults = 0;
+	sample->minor_faults = 0;
+
+#ifdef CTEST_POSIX
+	if(getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		sample->peak = usage.ru_maxrss / 1024;	/* bytes, not kB */
+#else
+		sample->peak = usage.ru_maxrss;
+#endif
+		sample->rss = sample->peak;
+		sample->major_faults = usage.ru_majflt;
+		sample->minor_faults = usage.ru_minflt;
+	}
+#endif
+
+	fp = fopen("/proc/self/status", "r");
+	if(fp) {
+		while(fgets(line, sizeof(line), fp)) {
+			if(strncmp(line, "VmRSS:", 6) == 0) {
+				sample->rss = atol(line+6);
+			} else if(strncmp(line, "VmHWM:", 6) == 0) {
+				sample->peak = atol(line+6);
+			}
+		}
+		fclose(fp);
+	}
+}
+
+
+CTEST_SECTION long ctest_resident_kb()
+{
+	struct memory_sample sample;
+	sample_memory(&sample);
+	return sample.rss;
+}
+
+
+/** Asks Linux to reset VmHWM to the current RSS.  Returns false if it can't. */
+
+CTEST_SECTION static int reset_peak_memory()
+{
+	FILE *fp = fopen("/proc/self/clear_refs", "w");
+	if(!fp) {
+		return 0;
+	}
+	fputs("5", fp);
+	return fclose(fp) == 0;
+}
+
+
+CTEST_SECTION static void start_memory_accounting(struct test *test)
+{
+	struct memory_sample sample;
+	struct test *outer;
+
+	/* record the peak so far in the enclosing tests, then reset it */
+	sample_memory(&sample);
+	for(outer = test_head; outer; outer = outer->next) {
+		if(outer->mem_sampled && sample.peak > outer->mem_peak) {
+			outer->mem_peak = sample.peak;
+		}
+	}
+	if(reset_peak_memory()) {
+		sample_memory(&sample);
+	}
+
+	test->mem_sampled = 1;
+	test->mem_start = sample;
+	test->mem_peak = sample.peak;
+}
+
+
+/** Prints the test's memory usage.  Returns false if it blew its budget. */
+
+CTEST_SECTION static int finish_memory_accounting(struct test *test)
+{
+	struct memory_sample sample;
+	long growth;
+
+	sample_memory(&sample);
+	if(sample.peak > test->mem_peak) {
+		test->mem_peak = sample.peak;
+	}
+	if(test->next && test->next->mem_sampled && test->mem_peak > test->next->mem_peak) {
+		test->next->mem_peak = test->mem_peak;
+	}
+
+	growth = test->mem_peak - test->mem_start.rss;
+	if(ctest_preferences.memory) {
+		clear_progress();
+		write_test_path(ctest_stdout(), test);
+		fprintf(ctest_stdout(), ": peak RSS %+ld kB, %ld major and %ld minor page faults\n", growth,
+			sample.major_faults - test->mem_start.major_faults,
+			sample.minor_faults - test->mem_start.minor_faults);
+	}
+
+	if(test->mem_budget && growth > test->mem_budget) {
+		clear_progress();
+		fprintf(ctest_stderr(), "%s:%d: test %s grew peak RSS by %ld kB, its budget is %ld kB!\n",
+			test->file, test->line, test->name, growth, test->mem_budget);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/** Fails the current test if its peak RSS grows by more than kbytes
+ *  over what it was when the test started (or when this routine was
+ *  called, if memory accounting isn't turned on).
+ */
+
+CTEST_SECTION void ctest_memory_budget(long kbytes)
+{
+	if(!test_head) {
+		fprintf(ctest_stderr(), "Called ctest_memory_budget without having started a test!\n");
+		exit(240);
+	}
+
+	if(!test_head->mem_sampled) {
+		start_memory_accounting(test_head);
+	}
+	test_head->mem_budget = kbytes;
+}
+
+
+/*
+ *  Fixtures
+ *
+ *  A fixture is built the first time a test asks for it with
+ *  ctest_fixture() and then shared by every test nested in its scope.
+ *  The scope is the test that called ctest_fixture_scope(), or the
+ *  test that first asked for it if it was never scoped.  When the
+ *  scope's test finishes, whether it passed or failed, the fixture is
+ *  torn down.
+ */
+
+#define FIXTURE_EMPTY 0
+#define FIXTURE_BUILDING 1
+#define FIXTURE_BUILT 2
+
+
+CTEST_SECTION static void scope_fixture(struct ctest_fixture *fixture, struct test *test)
+{
+	fixture->scope = test;
+	fixture->state = FIXTURE_EMPTY;
+	fixture->data = NULL;
+	fixture->next = test->fixtures;
+	test->fixtures = fixture;
+}
+
+
+/** Detaches the most recently scoped fixture from the test and tears it down. */
+
+CTEST_SECTION static void teardown_fixture(struct test *test)
+{
+	struct ctest_fixture *fixture = test->fixtures;
+	int state = fixture->state;
+
+	test->fixtures = fixture->next;
+	fixture->next = NULL;
+	fixture->scope = NULL;
+	fixture->state = FIXTURE_EMPTY;
+
+	if(state == FIXTURE_BUILT) {
+		if(ctest_preferences.verbosity >= 2) {
+			print_test_indentation();
+			fprintf(ctest_stdout(), "tearing down fixture %s\n", fixture->name);
+		}
+		if(fixture->teardown) {
+			fixture->teardown(fixture->data);
+		}
+	}
+	fixture->data = NULL;
+}
+
+
+/** Makes the fixture available to the current test and every test nested
+ *  inside it.  Nothing is built until a test calls ctest_fixture().
+ *  If an enclosing test has already scoped the fixture, this does nothing.
+ */
+
+CTEST_SECTION void ctest_fixture_scope(struct ctest_fixture *fixture)
+{
+	if(!test_head) {
+		fprintf(ctest_stderr(), "Called ctest_fixture_scope without having started a test!\n");
+		exit(240);
+	}
+
+	if(!fixture->scope) {
+		scope_fixture(fixture, test_head);
+	}
+}
+
+
+/** Returns the fixture's data, calling its setup routine if this is the
+ *  first time it has been used in its scope.
+ */
+
+CTEST_SECTION void *ctest_fixture(struct ctest_fixture *fixture)
+{
+	if(!test_head) {
+		fprintf(ctest_stderr(), "Called ctest_fixture without having started a test!\n");
+		exit(240);
+	}
+
+	if(!fixture->scope) {
+		scope_fixture(fixture, test_head);
+	}
+
+	if(fixture->state == FIXTURE_BUILT) {
+		return fixture->data;
+	}
+
+	if(fixture->state == FIXTURE_BUILDING) {
+		/* a previous setup was aborted by a failed assert, don't bother retrying */
+		ctest_assert_fmt(0, __FILE__, __LINE__, "setup of fixture %s failed earlier", fixture->name);
+	}
+
+	if(ctest_preferences.verbosity >= 2) {
+		print_test_indentation();
+		fprintf(ctest_stdout(), "setting up fixture %s\n", fixture->name);
+	}
+
+	fixture->state = FIXTURE_BUILDING;
+	fixture->data = fixture->setup ? fixture->setup() : NULL;
+	fixture->state = FIXTURE_BUILT;
+
+	return fixture->data;
+}
+
+
+/*
+ *  Output capture
+ *
+ *  With --capture, everything written to fds 1 and 2 while a top-level
+ *  test runs goes into an unlinked temporary file instead.  If the test
+ *  or any test nested in it fails, the output is printed after the
+ *  failure messages, otherwise it's thrown away.  ctest's own reports
+ *  go to duplicates of the original fds so they're never captured.
+ *  Forked tests inherit the fds so their output is captured too.
+ */
+
+/** Where ctest prints its reports while output is being captured. */
+static FILE *report_out, *report_err;
+static FILE *capture_file;
+
+
+FILE* ctest_stdout()
+{
+	return report_out ? report_out : stdout;
+}
+
+
+FILE* ctest_stderr()
+{
+	return report_err ? report_err : stderr;
+}
+
+
+#ifdef CTEST_POSIX
+
+/** Opens the capture file and the report streams.  Returns false if it couldn't. */
+
+CTEST_SECTION static int open_capture()
+{
+	int out, err;
+
+	fflush(NULL);
+	capture_file = tmpfile();
+	out = dup(STDOUT_FILENO);
+	err = dup(STDERR_FILENO);
+	if(capture_file && out >= 0 && err >= 0) {
+		report_out = fdopen(out, "w");
+		report_err = fdopen(err, "w");
+	}
+	if(!report_out || !report_err) {
+		fprintf(stderr, "Could not capture test output, showing it instead.\n");
+		ctest_preferences.capture = 0;
+		return 0;
+	}
+	setvbuf(report_err, NULL, _IONBF, 0);
+	return 1;
+}
+
+
+CTEST_SECTION static void start_capture(struct test *test)
+{
+	if(!capture_file && !open_capture()) {
+		return;
+	}
+
+	fflush(NULL);
+	dup2(fileno(capture_file), STDOUT_FILENO);
+	dup2(fileno(capture_file), STDERR_FILENO);
+	test->capture_failures = metrics.test_failures;
+}
+
+
+/** Prints what was written to the capture file since it was emptied. */
+
+CTEST_SECTION static void replay_capture(struct test *test, off_t size)
+{
+	char buf[BUFSIZ];
+	ssize_t len;
+	int fd = fileno(capture_file);
+	int newline = 1;
+
+	clear_progress();
+	fprintf(report_err, "%s:%d: output of test %s:\n", test->file, test->line, test->name);
+	lseek(fd, 0, SEEK_SET);
+	while(size > 0 && (len = read(fd, buf, sizeof(buf))) > 0) {
+		fwrite(buf, 1, len, report_err);
+		newline = buf[len-1] == '\n';
+		size -= len;
+	}
+	if(!newline) {
+		fputc('\n', report_err);
+	}
+}
+
+
+CTEST_SECTION static void finish_capture(struct test *test)
+{
+	int fd = fileno(capture_file);
+	off_t size;
+
+	fflush(NULL);
+	dup2(fileno(report_out), STDOUT_FILENO);
+	dup2(fileno(report_err), STDERR_FILENO);
+
+	size = lseek(fd, 0, SEEK_CUR);
+	if(size > 0 && metrics.test_failures > test->capture_failures) {
+		replay_capture(test, size);
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	if(ftruncate(fd, 0) != 0) {
+		/* leave it, the next test overwrites it anyway */
+	}
+	test->capture_failures = -1;
+}
+
+#endif
+
+
+/*
+ *  Profiler
+ *
+ *  With --profile=FILE, a SIGPROF timer interrupts the process after
+ *  every PROFILE_INTERVAL microseconds of CPU time (or every clock tick,
+ *  if the kernel's ticks are longer than that) and the handler saves
+ *  the stack along with the test that was running.  ctest_exit() writes
+ *  the samples to FILE as folded stacks, one line per distinct stack:
+ *      Parser/Numbers;main;run_tests;parse_number 42
+ *  flamegraph.pl, speedscope and the like turn these into flame graphs.
+ *  The first frame is the path of the test, so each test gets its own
+ *  tower.  Functions are named from the binaries' ELF symbol tables so
+ *  static functions are named too.  Frames that can't be named (stripped
+ *  binaries) are written as binary+0xOFFSET, which addr2line understands.
+ *
+ *  The handler can't allocate, so samples go into a fixed buffer.  When
+ *  the buffer fills up, each frame is replaced by the start of its
+ *  function and identical samples are merged.  That happens outside the
+ *  handler: it only asks for it, and the next test start or finish, or
+ *  assert that isn't a fast pass, does the work.  Sampling
+ *  doesn't change which path asserts take.  Samples that arrive while
+ *  the buffer is full are dropped and counted.  A forked test's child appends its own
+ *  samples to FILE.
+ *
+ *  backtrace() isn't async-signal-safe, so the handler walks the frame
+ *  pointers itself, starting from the registers saved in the signal
+ *  context.  It only follows frames on the main thread's stack; samples
+ *  from other threads, like ctest_stress workers, just record where they
+ *  were.  Code built without frame pointers (-O2 without
+ *  -fno-omit-frame-pointer, most of libc) hides its caller.
+ *  Linux on x86_64 and aarch64 only: it reads the registers out of the
+ *  signal context and the binaries from /proc/self/maps.
+ */
+
+#ifdef CTEST_PROFILER
+
+#define PROFILE_INTERVAL 1000
+#define PROFILE_DEPTH 32
+#define PROFILE_SAMPLES 16384
+
+/* uc_mcontext starts with the saved registers, glibc and musl name them differently */
+#define PROFILE_REGISTER(context, n) (((unsigned long*)&((ucontext_t*)(context))->uc_mcontext)[n])
+#if defined(__x86_64__)
+/* REG_RIP and REG_RBP */
+#define PROFILE_PC(context) PROFILE_REGISTER(context, 16)
+#define PROFILE_FP(context) PROFILE_REGISTER(context, 10)
+#else
+/* fault_address, x0-x30, sp, pc: the frame pointer is x29 */
+#define PROFILE_PC(context) PROFILE_REGISTER(context, 33)
+#define PROFILE_FP(context) PROFILE_REGISTER(context, 30)
+#endif
+
+#if defined(__LP64__) || defined(_LP64)
+typedef Elf64_Ehdr elf_ehdr;
+typedef Elf64_Phdr elf_phdr;
+typedef Elf64_Shdr elf_shdr;
+typedef Elf64_Sym elf_sym;
+#define ELF_SYM_TYPE(info) ELF64_ST_TYPE(info)
+#define ELF_NATIVE_CLASS ELFCLASS64
+#else
+typedef Elf32_Ehdr elf_ehdr;
+typedef Elf32_Phdr elf_phdr;
+typedef Elf32_Shdr elf_shdr;
+typedef Elf32_Sym elf_sym;
+#define ELF_SYM_TYPE(info) ELF32_ST_TYPE(info)
+#define ELF_NATIVE_CLASS ELFCLASS32
+#endif
+
+struct profile_sample {
+	/** the index of the test's path in ::profile_paths. */
+	int test;
+	int depth;
+	/** true until the frames have been replaced by function starts. */
+	int raw;
+	long count;
+	void *pcs[PROFILE_DEPTH];
+};
+
+/** A function in one of the loaded binaries. */
+struct profile_symbol {
+	unsigned long start;
+	unsigned long size;
+	const char *name;
+};
+
+/** An executable mapping from /proc/self/maps. */
+struct profile_module {
+	unsigned long start, end;
+	/** what the binary's addresses are offset by in memory. */
+	unsigned long base;
+	const char *name;
+};
+
+static struct profile_sample *profile_samples;
+/** the number of slots claimed.  Can run past PROFILE_SAMPLES when full. */
+static volatile int profile_count;
+static volatile int profile_dropped;
+/** the handler asks for a compaction when it claims this slot. */
+static volatile int profile_compact_at;
+static volatile sig_atomic_t profile_compact_wanted;
+/** set while the samples are being compacted, the handler drops samples. */
+static volatile int profile_busy;
+/** the number of handlers currently writing a sample. */
+static volatile int profile_writers;
+/** the main thread's stack.  Frames outside it aren't followed. */
+static unsigned long profile_stack_start, profile_stack_end;
+static FILE *profile_fp;
+
+static char **profile_paths;
+static int profile_paths_count, profile_paths_size;
+
+static struct profile_symbol *profile_symbols;
+static int profile_symbols_count, profile_symbols_size;
+static struct profile_module *profile_modules;
+static int profile_modules_count, profile_modules_size;
+static int profile_symbols_loaded;
+
+
+/** Returns true if fp points at a frame record on the main thread's
+ *  stack above low: the caller's frame pointer then the return address.
+ *  Everything from low, where the handler is running, to the end of the
+ *  stack is mapped.  Other threads' stacks are somewhere else. */
+
+CTEST_SECTION static int profile_frame_ok(unsigned long fp, unsigned long low)
+{
+	return low >= profile_stack_start && fp >= low && fp % sizeof(long) == 0 &&
+		fp + 2 * sizeof(long) <= profile_stack_end;
+}
+
+
+/** SIGPROF can arrive on any thread so slots are claimed atomically. */
+
+CTEST_SECTION static void profile_handler(int sig, siginfo_t *info, void *context)
+{
+	struct profile_sample *sample;
+	unsigned long *fp;
+	/* the handler runs on the interrupted stack, so its frames are below here */
+	unsigned long low = (unsigned long)&sample;
+	int saved_errno = errno;
+	int i;
+
+	(void)sig;
+	(void)info;
+	__sync_fetch_and_add(&profile_writers, 1);
+	if(profile_busy) {
+		__sync_fetch_and_add(&profile_dropped, 1);
+		goto done;
+	}
+	i = __sync_fetch_and_add(&profile_count, 1);
+	if(i >= PROFILE_SAMPLES) {
+		__sync_fetch_and_add(&profile_dropped, 1);
+		goto done;
+	}
+	if(i == profile_compact_at) {
+		profile_compact_wanted = 1;
+	}
+
+	sample = &profile_samples[i];
+	sample->test = profile_test;
+	sample->raw = 1;
+	sample->count = 1;
+	sample->depth = 0;
+	sample->pcs[sample->depth++] = (void*)PROFILE_PC(context);
+	fp = (unsigned long*)PROFILE_FP(context);
+	while(sample->depth < PROFILE_DEPTH && profile_frame_ok((unsigned long)fp, low) && fp[1]) {
+		sample->pcs[sample->depth++] = (void*)fp[1];
+		/* the stack grows down so callers' frames are always higher */
+		if(fp[0] <= (unsigned long)fp) {
+			break;
+		}
+		fp = (unsigned long*)fp[0];
+	}
+
+done:
+	__sync_fetch_and_sub(&profile_writers, 1);
+	errno = saved_errno;
+}
+
+
+CTEST_SECTION static void set_profile_timer(long usec)
+{
+	struct itimerval timer;
+
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = usec;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+
+/** Adds a test path to ::profile_paths.  Returns its index. */
+
+CTEST_SECTION static int add_profile_path(const char *path)
+{
+	if(profile_paths_count >= profile_paths_size) {
+		profile_paths_size = profile_paths_size ? profile_paths_size * 2 : 64;
+		profile_paths = ctest_realloc(profile_paths, profile_paths_size * sizeof(char*));
+	}
+	profile_paths[profile_paths_count] = ctest_strdup(path);
+	return profile_paths_count++;
+}
+
+
+/** Opens the profile.  It's written in append mode so forked children
+ *  and the parent don't overwrite each other's samples. */
+
+CTEST_SECTION static void open_profile(const char *mode)
+{
+	profile_fp = fopen(ctest_preferences.profile, mode);
+	if(!profile_fp) {
+		fprintf(ctest_stderr(), "Could not open profile %s!\n", ctest_preferences.profile);
+		exit(241);
+	}
+}
+
+
+/** Finds the main thread's stack in /proc/self/maps.  It can grow
+ *  down as far as the stack limit. */
+
+CTEST_SECTION static void find_profile_stack()
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	unsigned long start, end;
+	struct rlimit limit;
+	int n;
+
+	fp = fopen("/proc/self/maps", "r");
+	if(!fp) {
+		return;
+	}
+	while(read_line(fp, &buf, &size)) {
+		if(sscanf(buf, "%lx-%lx %*s %*s %*s %*s %n", &start, &end, &n) == 2 &&
+			strncmp(buf + n, "[stack]", 7) == 0) {
+			profile_stack_start = start;
+			profile_stack_end = end;
+			break;
+		}
+	}
+	free(buf);
+	fclose(fp);
+
+	if(profile_stack_end && getrlimit(RLIMIT_STACK, &limit) == 0 &&
+		limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < profile_stack_end) {
+		if(profile_stack_end - limit.rlim_cur < profile_stack_start) {
+			profile_stack_start = profile_stack_end - limit.rlim_cur;
+		}
+	}
+}
+
+
+/** Called before the first test starts. */
+
+CTEST_SECTION static void start_profiler()
+{
+	struct sigaction sa;
+
+	open_profile("w");
+	fclose(profile_fp);
+	open_profile("a");
+	profile_samples = ctest_malloc(PROFILE_SAMPLES * sizeof(struct profile_sample));
+	profile_compact_at = PROFILE_SAMPLES / 2;
+	find_profile_stack();
+	add_profile_path(TOP_LEVEL);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = profile_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, NULL);
+	set_profile_timer(PROFILE_INTERVAL);
+}
+
+
+/** Reads the functions in the symbol table of the named binary,
+ *  which was mapped at start.  Returns the offset its addresses
+ *  were loaded at. */
+
+CTEST_SECTION static unsigned long load_elf_symbols(const char *path, unsigned long start)
+{
+	FILE *fp;
+	elf_ehdr ehdr;
+	elf_phdr phdr;
+	elf_shdr *shdrs = NULL;
+	elf_sym *syms = NULL;
+	char *strtab = NULL;
+	unsigned long base = start;
+	unsigned long count, i;
+	int table = -1;
+	int n;
+
+	fp = fopen(path, "rb");
+	if(!fp) {
+		return base;
+	}
+	if(fread(&ehdr, sizeof(ehdr), 1, fp) != 1 || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+		ehdr.e_ident[EI_CLASS] != ELF_NATIVE_CLASS) {
+		goto done;
+	}
+
+	/* the file's first page was mapped at start */
+	for(n=0; n<ehdr.e_phnum; n++) {
+		if(fseek(fp, ehdr.e_phoff + n * ehdr.e_phentsize, SEEK_SET) != 0 ||
+			fread(&phdr, sizeof(phdr), 1, fp) != 1) {
+			goto done;
+		}
+		if(phdr.p_type == PT_LOAD && phdr.p_offset == 0) {
+			base = start - phdr.p_vaddr;
+			break;
+		}
+	}
+
+	shdrs = ctest_malloc(ehdr.e_shnum * sizeof(elf_shdr) + 1);
+	for(n=0; n<ehdr.e_shnum; n++) {
+		if(fseek(fp, ehdr.e_shoff + n * ehdr.e_shentsize, SEEK_SET) != 0 ||
+			fread(&shdrs[n], sizeof(elf_shdr), 1, fp) != 1) {
+			goto done;
+		}
+		/* prefer the full symbol table over the dynamic one */
+		if(shdrs[n].sh_type == SHT_SYMTAB || (shdrs[n].sh_type == SHT_DYNSYM && table < 0)) {
+			table = n;
+		}
+	}
+	if(table < 0 || shdrs[table].sh_link >= ehdr.e_shnum) {
+		goto done;
+	}
+
+	count = shdrs[table].sh_size / sizeof(elf_sym);
+	syms = ctest_malloc(count * sizeof(elf_sym) + 1);
+	strtab = ctest_malloc(shdrs[shdrs[table].sh_link].sh_size + 1);
+	if(fseek(fp, shdrs[table].sh_offset, SEEK_SET) != 0 ||
+		fread(syms, sizeof(elf_sym), count, fp) != count ||
+		fseek(fp, shdrs[shdrs[table].sh_link].sh_offset, SEEK_SET) != 0 ||
+		fread(strtab, 1, shdrs[shdrs[table].sh_link].sh_size, fp) != shdrs[shdrs[table].sh_link].sh_size) {
+		free(strtab);
+		strtab = NULL;
+		goto done;
+	}
+	strtab[shdrs[shdrs[table].sh_link].sh_size] = '\0';
+
+	for(i=0; i<count; i++) {
+		if(ELF_SYM_TYPE(syms[i].st_info) != STT_FUNC || syms[i].st_shndx == SHN_UNDEF ||
+			syms[i].st_value == 0 || syms[i].st_name >= shdrs[shdrs[table].sh_link].sh_size) {
+			continue;
+		}
+		if(profile_symbols_count >= profile_symbols_size) {
+			profile_symbols_size = profile_symbols_size ? profile_symbols_size * 2 : 1024;
+			profile_symbols = ctest_realloc(profile_symbols, profile_symbols_size * sizeof(struct profile_symbol));
+		}
+		profile_symbols[profile_symbols_count].start = base + syms[i].st_value;
+		profile_symbols[profile_symbols_count].size = syms[i].st_size;
+		/* strtab is never freed, the names point into it */
+		profile_symbols[profile_symbols_count].name = strtab + syms[i].st_name;
+		profile_symbols_count += 1;
+	}
+	if(!profile_symbols_count) {
+		free(strtab);
+	}
+
+done:
+	free(syms);
+	free(shdrs);
+	fclose(fp);
+	return base;
+}
+
+
+CTEST_SECTION static int compare_profile_symbols(const void *a, const void *b)
+{
+	unsigned long sa = ((const struct profile_symbol*)a)->start;
+	unsigned long sb = ((const struct profile_symbol*)b)->start;
+	return sa < sb ? -1 : sa > sb ? 1 : 0;
+}
+
+
+/** Finds the binaries in /proc/self/maps and reads their symbols. */
+
+CTEST_SECTION static void load_profile_symbols()
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	unsigned long start, end, offset, base = 0;
+	char perms[8];
+	char *path, *last_path = NULL;
+	int n;
+
+	profile_symbols_loaded = 1;
+	fp = fopen("/proc/self/maps", "r");
+	if(!fp) {
+		return;
+	}
+
+	while(read_line(fp, &buf, &size)) {
+		/* start-end perms offset dev inode path */
+		if(sscanf(buf, "%lx-%lx %7s %lx %*s %*s %n", &start, &end, perms, &offset, &n) != 4 ||
+			(buf[n] != '/' && buf[n] != '[')) {
+			continue;
+		}
+		path = buf + n;
+		if(!last_path || strcmp(path, last_path) != 0) {
+			free(last_path);
+			last_path = ctest_strdup(path);
+			if(path[0] == '[') {
+				/* [vdso] and friends aren't files, they're named but not symbolized */
+				base = 0;
+			} else {
+				base = offset == 0 ? load_elf_symbols(path, start) : start - offset;
+			}
+		}
+		if(strchr(perms, 'x')) {
+			if(profile_modules_count >= profile_modules_size) {
+				profile_modules_size = profile_modules_size ? profile_modules_size * 2 : 16;
+				profile_modules = ctest_realloc(profile_modules, profile_modules_size * sizeof(struct profile_module));
+			}
+			profile_modules[profile_modules_count].start = start;
+			profile_modules[profile_modules_count].end = end;
+			profile_modules[profile_modules_count].base = base;
+			profile_modules[profile_modules_count].name = ctest_strdup(path[0] == '[' ? path : strrchr(path, '/') + 1);
+			profile_modules_count += 1;
+		}
+	}
+
+	free(last_path);
+	free(buf);
+	fclose(fp);
+	qsort(profile_symbols, profile_symbols_count, sizeof(struct profile_symbol), compare_profile_symbols);
+}
+
+
+/** Returns the function containing pc, or NULL if it isn't known. */
+
+CTEST_SECTION static struct profile_symbol *find_profile_symbol(unsigned long pc)
+{
+	int lo = 0, hi = profile_symbols_count - 1, mid;
+
+	/* find the last function that starts at or before pc */
+	while(lo <= hi) {
+		mid = (lo + hi) / 2;
+		if(profile_symbols[mid].start <= pc) {
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	if(hi < 0 || (profile_symbols[hi].size && pc >= profile_symbols[hi].start + profile_symbols[hi].size)) {
+		return NULL;
+	}
+	return &profile_symbols[hi];
+}
+
+
+/** Replaces each frame with the start of its function so samples
+ *  in the same functions can be merged. */
+
+CTEST_SECTION static void canonicalize_sample(struct profile_sample *sample)
+{
+	struct profile_symbol *sym;
+	unsigned long pc;
+	int i;
+
+	for(i=0; i<sample->depth; i++) {
+		pc = (unsigned long)sample->pcs[i];
+		/* the others are return addresses, which may be just past the end of the caller */
+		sym = find_profile_symbol(i == 0 ? pc : pc - 1);
+		if(sym) {
+			sample->pcs[i] = (void*)sym->start;
+		}
+	}
+	sample->raw = 0;
+}
+
+
+CTEST_SECTION static int compare_profile_samples(const void *a, const void *b)
+{
+	const struct profile_sample *sa = a, *sb = b;
+	int cmp = strcmp(profile_paths[sa->test], profile_paths[sb->test]);
+
+	if(cmp == 0) {
+		cmp = sa->depth - sb->depth;
+	}
+	if(cmp == 0) {
+		cmp = memcmp(sa->pcs, sb->pcs, sa->depth * sizeof(void*));
+	}
+	return cmp;
+}
+
+
+/** Merges identical samples to make room for more. */
+
+CTEST_SECTION static void compact_profile()
+{
+	sigset_t set, old;
+	int i, total, count = 0;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGPROF);
+	sigprocmask(SIG_BLOCK, &set, &old);
+	/* other threads' handlers drop their samples until we're done */
+	profile_busy = 1;
+	__sync_synchronize();
+	while(profile_writers > 0) {
+		/* a handler on another thread is finishing its sample */
+	}
+
+	if(!profile_symbols_loaded) {
+		load_profile_symbols();
+	}
+	total = profile_count < PROFILE_SAMPLES ? profile_count : PROFILE_SAMPLES;
+	for(i=0; i<total; i++) {
+		if(profile_samples[i].raw) {
+			canonicalize_sample(&profile_samples[i]);
+		}
+	}
+	qsort(profile_samples, total, sizeof(struct profile_sample), compare_profile_samples);
+	for(i=0; i<total; i++) {
+		if(count > 0 && compare_profile_samples(&profile_samples[count-1], &profile_samples[i]) == 0) {
+			profile_samples[count-1].count += profile_samples[i].count;
+		} else {
+			profile_samples[count++] = profile_samples[i];
+		}
+	}
+	profile_count = count;
+	/* ask again when half of what's left has been used */
+	profile_compact_at = count + (PROFILE_SAMPLES - count) / 2;
+	profile_compact_wanted = 0;
+
+	__sync_synchronize();
+	profile_busy = 0;
+	sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+
+/** Compacts the samples if the handler has asked for it.  Called
+ *  wherever a running test calls into ctest.  Not during a stress run,
+ *  where this may be one of several worker threads. */
+
+CTEST_SECTION static void check_profile()
+{
+	if(profile_compact_wanted && profile_fp && !ctest_internal_threads) {
+		compact_profile();
+	}
+}
+
+
+/** Writes a frame's name, or binary+0xOFFSET if it has none. */
+
+CTEST_SECTION static void write_profile_frame(FILE *fp, void *frame)
+{
+	unsigned long pc = (unsigned long)frame;
+	struct profile_symbol *sym = find_profile_symbol(pc);
+	int i;
+
+	if(sym) {
+		fputs(sym->name, fp);
+		return;
+	}
+	for(i=0; i<profile_modules_count; i++) {
+		if(pc >= profile_modules[i].start && pc < profile_modules[i].end) {
+			if(profile_modules[i].base) {
+				fprintf(fp, "%s+0x%lx", profile_modules[i].name, pc - profile_modules[i].base);
+			} else {
+				fputs(profile_modules[i].name, fp);
+			}
+			return;
+		}
+	}
+	fprintf(fp, "0x%lx", pc);
+}
+
+
+CTEST_SECTION static void write_test_name(FILE *fp, const char *path)
+{
+	/* ; separates the frames */
+	for(; *path; path++) {
+		putc(*path == ';' ? ':' : *path, fp);
+	}
+}
+
+
+/** Writes the samples as folded stacks, outermost frame first. */
+
+CTEST_SECTION static void write_profile()
+{
+	struct profile_sample *sample;
+	int i, j;
+
+	set_profile_timer(0);
+	compact_profile();
+
+	for(i=0; i<profile_count; i++) {
+		sample = &profile_samples[i];
+		write_test_name(profile_fp, profile_paths[sample->test]);
+		for(j=sample->depth-1; j>=0; j--) {
+			putc(';', profile_fp);
+			write_profile_frame(profile_fp, sample->pcs[j]);
+		}
+		fprintf(profile_fp, " %ld\n", sample->count);
+	}
+	fclose(profile_fp);
+	profile_fp = NULL;
+
+	if(profile_dropped) {
+		clear_progress();
+		fprintf(ctest_stderr(), "The profile buffer was full, %d sample%s dropped.\n",
+			profile_dropped, (profile_dropped == 1 ? " was" : "s were"));
+	}
+}
+
+
+/** Called in a forked child.  The timer isn't inherited and the
+ *  parent writes its own samples. */
+
+CTEST_SECTION static void fork_profiler()
+{
+	profile_count = 0;
+	profile_dropped = 0;
+	profile_compact_at = PROFILE_SAMPLES / 2;
+	profile_compact_wanted = 0;
+	set_profile_timer(PROFILE_INTERVAL);
+}
+
+#endif
+
+
+/*
+ *  Forked tests
+ *
+ *  A test can ask for each of the tests nested directly inside it to be
+ *  run in a forked process (or --fork does this for top-level tests).
+ *  The child gets a copy-on-write snapshot of everything the parent has
+ *  built, such as fixtures, so every test sees pristine state.  When the
+ *  child's test finishes it writes how much it changed ::metrics to a
+ *  pipe and exits.  The parent adds that to its own metrics.  If the
+ *  child dies without reporting, the test is counted as a failure.
+ */
+
+/** Runs each test nested directly inside the current test in its own
+ *  forked process.  Does nothing on systems without fork().
+ */
+
+CTEST_SECTION void ctest_fork_children()
+{
+	if(!test_head) {
+		fprintf(ctest_stderr(), "Called ctest_fork_children without having started a test!\n");
+		exit(240);
+	}
+	test_head->fork_children = 1;
+}
+
+
+CTEST_SECTION static int should_fork(struct test *test)
+{
+#ifdef CTEST_POSIX
+	return test->next ? test->next->fork_children : ctest_preferences.fork;
+#else
+	return 0;
+#endif
+}
+
+
+#ifdef CTEST_POSIX
+
+/** Sends the impact records the child recorded to the parent, in the
+ *  index's format, after the metrics. */
+
+CTEST_SECTION static void write_forked_impact(struct test *test)
+{
+	struct impact_record *rec;
+	FILE *fp = fdopen(test->fork_pipe, "w");
+	int i;
+
+	if(!fp) {
+		return;
+	}
+	for(rec = impact_list_head; rec; rec = rec->list_next) {
+		if(rec->serial > test->fork_impact_serial) {
+			fputs(rec->key, fp);
+			for(i=0; i<rec->files_count; i++) {
+				fprintf(fp, "\t%s", rec->files[i]);
+			}
+			fputc('\n', fp);
+		}
+	}
+	fclose(fp);
+}
+
+
+/** Reads the impact records sent by write_forked_impact() into the
+ *  index.  Like record_test_impact(), passes the dependencies on to
+ *  the enclosing test. */
+
+CTEST_SECTION static void read_forked_impact(struct test *test, int fd)
+{
+	FILE *fp = fdopen(dup(fd), "r");
+	char *buf = NULL;
+	size_t size;
+	char *name, *dep, *next, *key;
+	struct impact_record *rec;
+	int i;
+
+	if(!fp) {
+		return;
+	}
+	while(read_line(fp, &buf, &size)) {
+		if(!(name = strchr(buf, '\t'))) {
+			continue;
+		}
+		dep = strchr(name+1, '\t');
+		if(dep) {
+			*dep++ = '\0';
+		}
+		rec = refresh_impact_record(buf);
+		for(; dep; dep = next) {
+			next = strchr(dep, '\t');
+			if(next) {
+				*next++ = '\0';
+			}
+			impact_record_add_file(rec, dep);
+		}
+	}
+	free(buf);
+	fclose(fp);
+
+	if(test->next) {
+		key = make_test_key(test->file, test->line, test->name);
+		rec = find_impact_record(key, 0);
+		free(key);
+		for(i=0; rec && i<rec->files_count; i++) {
+			record_source_file(test->next, rec->files[i]);
+		}
+	}
+}
+
+
+/** Forks a process to run the test.  Returns 1 in the child, which
+ *  should run the test, and 0 in the parent once the child is done.
+ */
+
+CTEST_SECTION static int run_forked_test(struct test *test)
+{
+	int fds[2];
+	pid_t pid;
+	int status;
+	struct ctest_metrics delta;
+	size_t got = 0;
+	ssize_t cnt;
+
+	/* otherwise passes that haven't been counted and anything buffered
+	 * would be counted and printed twice */
+	if(ctest_batch_passes) {
+		flush_batch();
+	}
+	/* The children share the result file with us.  If the first one
+	 * opened it, our own open would truncate what the children wrote. */
+	if(ctest_preferences.results) {
+		results_file();
+	}
+	/* the child writes asserts lines for its own asserts */
+	if(ctest_preferences.checkpoint) {
+		write_checkpoint_asserts();
+	}
+	clear_progress();
+	fflush(NULL);
+
+	if(pipe(fds) < 0 || (pid = fork()) < 0) {
+		perror("Could not fork test, running it in-process");
+		return 1;
+	}
+
+	if(pid == 0) {
+		close(fds[0]);
+		test->fork_pipe = fds[1];
+		test->fork_metrics = metrics;
+		test->fork_impact_serial = impact_serial;
+#ifdef CTEST_PROFILER
+		if(profile_fp) {
+			fork_profiler();
+		}
+#endif
+		return 1;
+	}
+
+	close(fds[1]);
+	while(got < sizeof(delta)) {
+		cnt = read(fds[0], (char*)&delta + got, sizeof(delta) - got);
+		if(cnt <= 0) {
+			break;
+		}
+		got += cnt;
+	}
+	if(got == sizeof(delta) && ctest_preferences.impact_index) {
+		read_forked_impact(test, fds[0]);
+	}
+	close(fds[0]);
+	while(waitpid(pid, &status, 0) < 0) {
+		/* retry, we were interrupted */
+	}
+
+	if(got == sizeof(delta)) {
+		metrics.tests_run += delta.tests_run;
+		metrics.test_successes += delta.test_successes;
+		metrics.test_failures += delta.test_failures;
+		metrics.assertions_run += delta.assertions_run;
+		metrics.tests_skipped += delta.tests_skipped;
+		metrics.tests_flaky += delta.tests_flaky;
+		/* the child already wrote asserts lines for these */
+		checkpoint_asserts += delta.assertions_run;
+	} else {
+		if(WIFSIGNALED(status)) {
+			fprintf(ctest_stderr(), "%s:%d: test %s crashed with signal %d!\n",
+				test->file, test->line, test->name, WTERMSIG(status));
+		} else {
+			fprintf(ctest_stderr(), "%s:%d: test %s exited with status %d before finishing!\n",
+				test->file, test->line, test->name, WEXITSTATUS(status));
+		}
+		metrics.test_failures += 1;
+		record_test_result(test, "crash", ctest_now() - test->start_time);
+	}
+	if(ctest_preferences.history && !test->next) {
+		/* the child's history is thrown away, record the test here */
+		record_test_history(test, got == sizeof(delta) && delta.test_failures == 0);
+	}
+
+	return 0;
+}
+
+
+/** Called in a forked child when its test is finished.  Never returns. */
+
+CTEST_SECTION static void finish_forked_test(struct test *test)
+{
+	struct ctest_metrics delta;
+	const char *ptr = (const char*)&delta;
+	size_t left = sizeof(delta);
+	ssize_t cnt;
+
+	delta.tests_run = metrics.tests_run - test->fork_metrics.tests_run;
+	delta.test_successes = metrics.test_successes - test->fork_metrics.test_successes;
+	delta.test_failures = metrics.test_failures - test->fork_metrics.test_failures;
+	delta.assertions_run = metrics.assertions_run - test->fork_metrics.assertions_run;
+	delta.tests_skipped = metrics.tests_skipped - test->fork_metrics.tests_skipped;
+	delta.tests_flaky = metrics.tests_flaky - test->fork_metrics.tests_flaky;
+
+	test_head = test->next;
+	if(ctest_preferences.verbosity >= 2) {
+		print_test_indentation();
+		fprintf(ctest_stdout(), "}\n");
+	}
+
+#ifdef CTEST_PROFILER
+	if(profile_fp) {
+		write_profile();
+	}
+#endif
+
+	clear_progress();
+	fflush(NULL);
+	while(left > 0 && (cnt = write(test->fork_pipe, ptr, left)) > 0) {
+		ptr += cnt;
+		left -= cnt;
+	}
+	if(ctest_preferences.impact_index) {
+		write_forked_impact(test);
+	}
+	_exit(0);
+}
+
+#endif
+
+
+CTEST_SECTION struct ctest_jmp_wrapper* ctest_internal_start_test(const char *name, const char *file, int line)
+{
+	struct test* test = malloc(sizeof(struct test));
+	if(!test) {
+		fprintf(ctest_stderr(), "Out of memory allocating struct test!\n");
+		exit(239);
+	}
+
+	if(!name || !name[0]) {
+		name = "(unnamed)";
+	}
+
+	/* count the enclosing test's passes so the progress line is current */
+	if(ctest_batch_passes) {
+		flush_batch();
+	}
+#ifdef CTEST_PROFILER
+	check_profile();
+#endif
+
+	if(run_start_time == 0) {
+		run_start_time = progress_last_check = progress_last_draw = ctest_now();
+#ifdef CTEST_PROFILER
+		if(ctest_preferences.profile) {
+			start_profiler();
+		}
+#endif
+	}
+
+	test->name = name;
+	test->file = file;
+	test->line = line;
+	test->start_time = ctest_now();
+	test->finished = 0;
+	test->inverted = 0;
+	test->resumed = test_is_resumed(name);
+	test->skipped = test->resumed || test_is_unaffected(file, line, name) || !test_is_selected(name) ||
+		test_is_over_budget(file, line, name);
+	test->retries = 0;
+	test->soft_max = ctest_preferences.soft_asserts;
+	test->soft_failures = 0;
+	test->fork_children = 0;
+	test->fork_pipe = -1;
+	test->mem_sampled = 0;
+	test->mem_peak = 0;
+	test->mem_budget = 0;
+	test->capture_failures = -1;
+	test->fixtures = NULL;
+	test->files = NULL;
+	test->files_count = 0;
+	test->files_size = 0;
+	test->profile_id = 0;
+#ifdef CTEST_PROFILER
+	if(profile_fp) {
+		char path[BUFSIZ];
+		make_test_path(path, sizeof(path), name);
+		test->profile_id = add_profile_path(path);
+	}
+#endif
+
+	if(test->skipped) {
+		metrics.tests_skipped += 1;
+		if(ctest_preferences.verbosity >= 1) {
+			print_test_indentation();
+			fprintf(ctest_stdout(), "Skipping %s at %s:%d\n", name, file, line);
+		}
+	} else {
+		metrics.tests_run += 1;
+		if(ctest_preferences.verbosity >= 1) {
+			print_test_indentation();
+			fprintf(ctest_stdout(), "%d. Running %s at %s:%d%s\n",
+				metrics.tests_run, name, file, line,
+				ctest_preferences.verbosity >= 2 ? " {" : "");
+		}
+		if(ctest_preferences.impact_index) {
+			record_source_file(test, file);
+		}
+	}
+
+	if(ctest_preferences.memory && !test->skipped) {
+		start_memory_accounting(test);
+	}
+
+#ifdef CTEST_POSIX
+	if(ctest_preferences.capture && !test->skipped && !test_head) {
+		start_capture(test);
+	}
+#endif
+
+	test_push(test);
+	update_fast_asserts();
+
+	if(ctest_preferences.checkpoint && !test->skipped) {
+		checkpoint_test_start(test);
+	}
+
+	if(ctest_preferences.progress && --progress_countdown <= 0) {
+		update_progress();
+	}
+
+	return &test_head->jmp;
+}
+
+
+/** Called when an assert longjmps out of a test.  Returns true if the
+ *  test should be retried, in which case ctest_internal_finish_test()
+ *  will be called to start it again.
+ */
+
+CTEST_SECTION int ctest_internal_retry_test()
+{
+	if(ctest_internal_finish_test(0)) {
+		test_head->finished = 0;
+		return 1;
+	}
+	return 0;
+}
+
+
+/** Finishes the tests nested inside the test whose jump buffer is test
+ *  as failures.  ctest.hpp calls this when an exception has unwound out
+ *  of their blocks, so they can't be retried.
+ */
+
+CTEST_SECTION void ctest_internal_unwind_tests(struct ctest_jmp_wrapper *test)
+{
+	while(test_head && &test_head->jmp != test) {
+		test_head->retries = ctest_preferences.retries;
+		ctest_internal_finish_test(0);
+	}
+}
+
+
+/** Called before and after the test block runs.  Returns true if the
+ *  block should be run (again).
+ */
+
+CTEST_SECTION int ctest_internal_finish_test(int success)
+{
+	if(!test_head) {
+		/* how could we end up here without a test_head?? */
+		fprintf(ctest_stderr(), "Internal finish error: somehow ctest_start didn't complete?\n");
+		exit(243);
+	}
+
+	if(test_head->skipped) {
+		record_test_result(test_head, "skip", 0.0);
+		test_pop();
+		return 0;
+	}
+
+	if(!test_head->finished) {
+		/* we haven't run the test yet, so run it. */
+		test_head->finished = 1;
+#ifdef CTEST_POSIX
+		/* a retry in a forked child runs in that child, it doesn't fork again */
+		if(should_fork(test_head) && test_head->fork_pipe < 0 && !run_forked_test(test_head)) {
+			/* the child process already ran the test */
+			if(test_head->capture_failures >= 0) {
+				finish_capture(test_head);
+			}
+			test_pop();
+			return 0;
+		}
+#endif
+		return 1;
+	}
+
+	if(ctest_batch_passes) {
+		flush_batch();
+	}
+
+	/* If a teardown fails an assert we longjmp back into this routine
+	 * with success=0, so detach each fixture before tearing it down. */
+	while(test_head->fixtures) {
+		teardown_fixture(test_head);
+	}
+
+	if(ctest_preferences.impact_index) {
+		record_test_impact(test_head);
+	}
+
+	if(test_head->mem_sampled && !finish_memory_accounting(test_head)) {
+		success = 0;
+	}
+
+	if(test_head->soft_failures > 0 && success) {
+		/* it made it to the end, so it didn't print anything yet */
+		clear_progress();
+		fprintf(ctest_stderr(), "%s:%d: test %s failed %d assert%s.\n",
+			test_head->file, test_head->line, test_head->name,
+			test_head->soft_failures, (test_head->soft_failures == 1 ? "" : "s"));
+		success = 0;
+	}
+
+	if(test_head->inverted) {
+		success = 1;
+	}
+
+	if(!success && test_head->retries < ctest_preferences.retries) {
+		/* run the test again right away */
+		test_head->retries += 1;
+		test_head->soft_failures = 0;
+		test_head->inverted = 0;
+		test_head->mem_sampled = 0;
+		test_head->mem_budget = 0;
+		if(ctest_preferences.memory) {
+			start_memory_accounting(test_head);
+		}
+		update_fast_asserts();
+		clear_progress();
+		fprintf(ctest_stderr(), "%s:%d: test %s failed, retrying (%d of %d)\n",
+			test_head->file, test_head->line, test_head->name,
+			test_head->retries, ctest_preferences.retries);
+		return 1;
+	}
+
+	if(success && test_head->retries) {
+		metrics.tests_flaky += 1;
+		clear_progress();
+		fprintf(ctest_stderr(), "%s:%d: test %s is flaky, it passed on retry %d\n",
+			test_head->file, test_head->line, test_head->name, test_head->retries);
+	} else if(success) {
+		metrics.test_successes += 1;
+	} else {
+		metrics.test_failures += 1;
+	}
+
+	record_test_result(test_head, !success ? "fail" : test_head->retries ? "flaky" : "ok",
+		ctest_now() - test_head->start_time);
+	if(ctest_preferences.history && !test_head->next) {
+		record_test_history(test_head, success);
+	}
+#ifdef CTEST_PROFILER
+	check_profile();
+#endif
+
+#ifdef CTEST_POSIX
+	if(test_head->fork_pipe >= 0) {
+		finish_forked_test(test_head);
+	}
+	if(test_head->capture_failures >= 0) {
+		finish_capture(test_head);
+	}
+#endif
+
+	test_pop();
+	update_fast_asserts();
+
+	if(ctest_preferences.verbosity >= 2) {
+		print_test_indentation();
+		fprintf(ctest_stdout(), "}\n");
+	}
+
+	return 0;
+}
+
+
+CTEST_SECTION void print_ctest_results()
+{
+	if(ctest_batch_passes) {
+		flush_batch();
+	}
+
+	if(metrics.test_failures == 0) {
+		fprintf(ctest_stdout(), "All OK.  %d test%s run, %d successe%s (%d assertion%s).\n",
+			metrics.tests_run, (metrics.tests_run == 1 ? "" : "s"),
+			metrics.test_successes, (metrics.test_successes == 1 ? "" : "s"),
+			metrics.assertions_run, (metrics.assertions_run == 1 ? "" : "s"));
+	} else {
+		fprintf(ctest_stdout(), "ERROR: %d failure%s in %d test%s run!\n",
+			metrics.test_failures, (metrics.test_failures == 1 ? "" : "s"),
+			metrics.tests_run, (metrics.tests_run == 1 ? "" : "s"));
+	}
+
+	if(metrics.tests_flaky) {
+		fprintf(ctest_stdout(), "%d flaky test%s passed on retry.\n", metrics.tests_flaky,
+			(metrics.tests_flaky == 1 ? "" : "s"));
+	}
+	if(metrics.tests_skipped) {
+		fprintf(ctest_stdout(), "%d test%s skipped.\n", metrics.tests_skipped,
+			(metrics.tests_skipped == 1 ? "" : "s"));
+	}
+	if(history.budget_skipped) {
+		fprintf(ctest_stdout(), "%d test%s skipped to fit the %gs time budget, saving about %.2fs.\n",
+			history.budget_skipped, (history.budget_skipped == 1 ? " was" : "s were"),
+			ctest_preferences.time_budget, history.budget_skipped_seconds);
+	}
+}
+
+
+/** You should have already run all tests.  This call will print their
+ * results (print_ctest_results()) and exit with the number of tests
+ * that failed as the error code (up to 100).
+ */
+
+CTEST_SECTION void ctest_exit()
+{
+	if(ctest_batch_passes) {
+		flush_batch();
+	}
+	if(ctest_preferences.impact_index) {
+		write_impact_index();
+	}
+	if(ctest_preferences.results) {
+		write_results_summary(results_file());
+		fclose(results_fp);
+		results_fp = NULL;
+	}
+	if(ctest_preferences.checkpoint) {
+		write_checkpoint_asserts();
+		write_results_summary(checkpoint_file());
+		fclose(checkpoint_fp);
+		checkpoint_fp = NULL;
+	}
+	if(ctest_preferences.history) {
+		write_history();
+	}
+#ifdef CTEST_PROFILER
+	if(profile_fp) {
+		write_profile();
+	}
+#endif
+
+	clear_progress();
+	if(supervised) {
+		/* the supervisor prints the summary */
+		exit(0);
+	}
+	print_ctest_results();
+	exit(metrics.test_failures < 100 ? metrics.test_failures : 100);
+}
+
+
+/** Normally, a failed assert causes the currently running test to be aborted.
+ *  But how do unit tests test their assert macros?  Invert the sense.
+ *  That way, if the assertion fails, that's what we expected, and the
+ *  test actually succeeds.  To start or stop inverting, call this routine.
+ */
+CTEST_SECTION int ctest_toggle_inversion()
+{
+	if(!test_head) {
+		fprintf(ctest_stderr(), "Called ctest_toggle_inversion without having started a test!\n");
+		exit(240);
+	}
+	if(ctest_batch_passes) {
+		/* they passed before the sense was flipped */
+		flush_batch();
+	}
+	test_head->inverted = !test_head->inverted;
+	update_fast_asserts();
+	return test_head->inverted;
+}
+
+
+#ifdef CTEST_POSIX
+
+/** The tests that started but didn't finish, innermost last. */
+struct unfinished_tests {
+	struct test_list locations;
+	struct test_list paths;
+};
+
+
+/** Reads the lines that a child added to the checkpoint file, starting
+ *  at *offset.  Returns true if the child made it to ctest_exit().
+ *  Sets *finished to the number of tests it finished.
+ */
+
+CTEST_SECTION static int scan_checkpoint(long *offset, struct unfinished_tests *unfinished, int *finished)
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	char *status, *location, *path;
+	int i, done = 0;
+
+	*finished = 0;
+	fp = fopen(ctest_preferences.checkpoint, "r");
+	if(!fp || fseek(fp, *offset, SEEK_SET) < 0) {
+		fprintf(ctest_stderr(), "Could not read checkpoint file %s!\n", ctest_preferences.checkpoint);
+		exit(241);
+	}
+
+	while(read_line(fp, &buf, &size)) {
+		if(strncmp(buf, "start\t", 6) == 0 && (path = strchr(buf+6, '\t'))) {
+			*path++ = '\0';
+			add_to_test_list(&unfinished->locations, buf+6);
+			add_to_test_list(&unfinished->paths, path);
+		} else if(parse_test_line(buf, &status, &location, &path)) {
+			*finished += 1;
+			/* pops the test and any tests a forked child left unfinished inside it */
+			for(i=unfinished->paths.count-1; i>=0; i--) {
+				if(strcmp(unfinished->paths.paths[i], path) == 0) {
+					while(unfinished->paths.count > i) {
+						pop_test_list(&unfinished->paths);
+						pop_test_list(&unfinished->locations);
+					}
+					break;
+				}
+			}
+		} else if(strncmp(buf, "summary\t", 8) == 0) {
+			done = 1;
+		}
+	}
+
+	*offset = ftell(fp);
+	free(buf);
+	fclose(fp);
+	return done;
+}
+
+
+/** Adds up the whole checkpoint file into ::metrics.  Asserts are
+ *  counted from the asserts lines since a run that died never wrote
+ *  its summary. */
+
+CTEST_SECTION static void total_checkpoint()
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t size;
+	char *status, *location, *path;
+	int assertions;
+
+	fp = fopen(ctest_preferences.checkpoint, "r");
+	if(!fp) {
+		return;
+	}
+
+	while(read_line(fp, &buf, &size)) {
+		if(parse_test_line(buf, &status, &location, &path)) {
+			if(strcmp(status, "skip") == 0) {
+				metrics.tests_skipped += 1;
+				continue;
+			}
+			metrics.tests_run += 1;
+			if(strcmp(status, "ok") == 0) {
+				metrics.test_successes += 1;
+			} else if(strcmp(status, "flaky") == 0) {
+				metrics.tests_flaky += 1;
+			} else {
+				metrics.test_failures += 1;
+			}
+		} else if(sscanf(buf, "asserts %d", &assertions) == 1) {
+			metrics.assertions_run += assertions;
+		}
+	}
+
+	free(buf);
+	fclose(fp);
+}
+
+
+CTEST_SECTION static void describe_exit(int status, char *buf)
+{
+	if(WIFSIGNALED(status)) {
+		sprintf(buf, "was killed by signal %d", WTERMSIG(status));
+	} else {
+		sprintf(buf, "exited with status %d", WEXITSTATUS(status));
+	}
+}
+
+
+/** Runs the tests in a child process, starting a new one whenever the
+ *  old one dies before ctest_exit(), until the tests are done.  The
+ *  child returns from this routine to run the tests.  The supervisor
+ *  doesn't return, it prints a summary of all the runs and exits.
+ *
+ *  The test that was running when a child died is recorded in the
+ *  checkpoint file as a crash, so the next child skips it along with
+ *  the tests that finished.  If a child dies outside of any test without
+ *  finishing a test, the next one would just die again, so we stop.
+ */
+
+CTEST_SECTION static void supervise()
+{
+	struct unfinished_tests unfinished;
+	FILE *fp;
+	long offset;
+	pid_t pid;
+	int status, finished, last;
+	char how[64];
+
+	fp = fopen(ctest_preferences.checkpoint, "w");
+	if(!fp) {
+		fprintf(ctest_stderr(), "Could not open checkpoint file %s!\n", ctest_preferences.checkpoint);
+		exit(241);
+	}
+	fprintf(fp, "# ctest checkpoint\n");
+	offset = ftell(fp);
+	fclose(fp);
+	memset(&unfinished, 0, sizeof(unfinished));
+
+	for(;;) {
+		fflush(NULL);
+		pid = fork();
+		if(pid < 0) {
+			perror("Could not fork, running the tests unsupervised");
+			return;
+		}
+		if(pid == 0) {
+			supervised = 1;
+			return;
+		}
+
+		while(waitpid(pid, &status, 0) < 0) {
+			/* retry, we were interrupted */
+		}
+		if(scan_checkpoint(&offset, &unfinished, &finished)) {
+			break;
+		}
+
+		describe_exit(status, how);
+		fp = fopen(ctest_preferences.checkpoint, "a");
+		if(!fp) {
+			fprintf(ctest_stderr(), "Could not open checkpoint file %s!\n", ctest_preferences.checkpoint);
+			exit(241);
+		}
+		last = unfinished.paths.count - 1;
+		if(last >= 0) {
+			fprintf(ctest_stderr(), "%s: test %s %s, restarting.\n",
+				unfinished.locations.paths[last], unfinished.paths.paths[last], how);
+			fprintf(fp, "test\tcrash\t0.000000\t%s\t%s\n",
+				unfinished.locations.paths[last], unfinished.paths.paths[last]);
+		} else if(finished > 0) {
+			fprintf(ctest_stderr(), "The test process %s outside of any test, restarting.\n", how);
+		} else {
+			fprintf(ctest_stderr(), "The test process %s outside of any test, giving up.\n", how);
+			fprintf(fp, "test\tcrash\t0.000000\t(unknown)\t" TOP_LEVEL "\n");
+			fclose(fp);
+			break;
+		}
+		offset = ftell(fp);
+		fclose(fp);
+
+		/* the tests that enclose the one that died will be started again */
+		while(unfinished.paths.count > 0) {
+			pop_test_list(&unfinished.paths);
+			pop_test_list(&unfinished.locations);
+		}
+	}
+
+	total_checkpoint();
+	print_ctest_results();
+	exit(metrics.test_failures < 100 ? metrics.test_failures : 100);
+}
+
+#endif
+
+
+/** Parses command-line arguments into ctest_preferences.
+ *
+ * Intended to be called before your application's command-line handling.
+ *
+ * Returns true if the user specified that unit tests should be run,
+ * false if not.  Feel free to ignore the function result and implement
+ * your own way of deciding whether or not to run the tests.
+ *
+ * Arguments:
+ *  * --ctest, --run-unit-tests: run unit tests and exit instead of starting the app.
+ *  * -v: be more verbose.  Specify multiple to increase the verbosity.
+ *  * --show-failures: print the output when inverted tests fail.
+ *        Allows you to see ctest's output for failing tests.
+ *  * --impact-index=FILE: record which source files each test depends on
+ *        in FILE (see ctest_preferences::impact_index).
+ *  * --changed=FILE,FILE,...: only run the tests that the impact index
+ *        says depend on one of these files.  Uses ctest.impact in the
+ *        current directory as the index, and updates it, if
+ *        --impact-index wasn't specified.
+ *  * --results=FILE: write machine-readable results to FILE.
+ *        Use ctest-merge to combine the results of several processes.
+ *  * --only=FILE: only run the tests whose paths are listed in FILE.
+ *  * --skip=FILE: don't run the tests whose paths are listed in FILE.
+ *  * --history=FILE: remember statistics about this run in FILE so the
+ *        next run can estimate how long it will take.
+ *  * --time-budget=SECONDS: only run the top-level tests most likely to
+ *        catch a failure in SECONDS, judging by their history.  Uses
+ *        ctest.history as the history if --history wasn't specified.
+ *  * --no-progress: don't show a progress line even though stdout is
+ *        a terminal.
+ *  * --progress: show a progress line even though stdout isn't a terminal.
+ *  * --fork: run each top-level test in its own forked process.
+ *  * --memory: print each test's peak RSS growth and page faults.
+ *  * --capture: hide what each top-level test writes to stdout and
+ *        stderr unless it fails.
+ *  * --retries=N: rerun a failed test up to N times.  Tests that pass
+ *        on a retry are reported as flaky rather than failed.
+ *  * --soft-asserts=N: let each test keep going after a failed assert,
+ *        until N of its asserts have failed.
+ *  * --checkpoint=FILE: record each test in FILE as it starts and
+ *        finishes, and skip the tests that already finished in FILE.
+ *  * --supervise=FILE: run the tests in a child process checkpointed
+ *        to FILE, restarting it whenever it dies.  POSIX only.
+ *  * --diff: when a string assert fails on multi-line strings, print a
+ *        unified diff of the lines that differ.
+ *  * --profile=FILE: sample the stack while the tests run and write
+ *        it to FILE as folded stacks for flame graphs, one tower per
+ *        test.  Linux on x86_64 and aarch64 only.
+ *
+ * NOTE: this routine does not display any errors.  If you mis-type, the
+ * argument will be silently ignored.
+ */
+
+CTEST_SECTION int ctest_read_args(int argc, char **argv)
+{
+	char *curarg;
+	int return_value = 0;
+	int progress = 1;
+
+	/* Don't use getopt because it's not on very many platforms.
+	 * Just do something super-simple.
+	 */
+	while(argc--) {
+		curarg = *argv++;
+
+		if(strcmp(curarg, "--ctest") == 0 ||
+		   strcmp(curarg, "--run-unit-tests") == 0) {
+			return_value = 1;
+		} else if(strcmp(curarg, "--show-failures") == 0) {
+			ctest_preferences.show_failures = 1;
+		} else if(strncmp(curarg, "--impact-index=", 15) == 0) {
+			ctest_preferences.impact_index = curarg + 15;
+		} else if(strcmp(curarg, "--capture") == 0) {
+			ctest_preferences.capture = 1;
+		} else if(strcmp(curarg, "--diff") == 0) {
+			ctest_preferences.diff = 1;
+		} else if(strncmp(curarg, "--profile=", 10) == 0) {
+			ctest_preferences.profile = curarg + 10;
+		} else if(strncmp(curarg, "--soft-asserts=", 15) == 0) {
+			ctest_preferences.soft_asserts = atoi(curarg + 15);
+		} else if(strncmp(curarg, "--checkpoint=", 13) == 0) {
+			ctest_preferences.checkpoint = curarg + 13;
+		} else if(strncmp(curarg, "--supervise=", 12) == 0) {
+			ctest_preferences.checkpoint = curarg + 12;
+			ctest_preferences.supervise = 1;
+		} else if(strncmp(curarg, "--retries=", 10) == 0) {
+			ctest_preferences.retries = atoi(curarg + 10);
+		} else if(strcmp(curarg, "--memory") == 0) {
+			ctest_preferences.memory = 1;
+		} else if(strcmp(curarg, "--fork") == 0) {
+			ctest_preferences.fork = 1;
+		} else if(strcmp(curarg, "--no-progress") == 0) {
+			progress = 0;
+		} else if(strcmp(curarg, "--progress") == 0) {
+			ctest_preferences.progress = 1;
+		} else if(strncmp(curarg, "--history=", 10) == 0) {
+			ctest_preferences.history = curarg + 10;
+		} else if(strncmp(curarg, "--time-budget=", 14) == 0) {
+			ctest_preferences.time_budget = atof(curarg + 14);
+			if(!ctest_preferences.history) {
+				ctest_preferences.history = "ctest.history";
+			}
+		} else if(strncmp(curarg, "--results=", 10) == 0) {
+			ctest_preferences.results = curarg + 10;
+		} else if(strncmp(curarg, "--only=", 7) == 0) {
+			ctest_preferences.only = curarg + 7;
+		} else if(strncmp(curarg, "--skip=", 7) == 0) {
+			ctest_preferences.skip = curarg + 7;
+		} else if(strncmp(curarg, "--changed=", 10) == 0) {
+			ctest_preferences.changed = curarg + 10;
+			if(!ctest_preferences.impact_index) {
+				ctest_preferences.impact_index = "ctest.impact";
+			}
+		} else if(*curarg == '-') {
+			switch(*++curarg) {
+			case 'v':
+				while(*curarg++ == 'v')
+					ctest_preferences.verbosity += 1;
+				break;
+			default: ; /* do nothing */
 			}
 		} else {
 			/* unknown argument */
 		}
 	}
 
+#ifdef CTEST_POSIX
+	if(progress && isatty(STDOUT_FILENO)) {
+		ctest_preferences.progress = 1;
+	}
+	if(ctest_preferences.supervise) {
+		supervise();
+	}
+#endif
+	update_fast_asserts();
+
 	return return_value;
 }
 
@@ -33,6 +33,50 @@
 #include <setjmp.h>
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Keeps test code out of the production working set.
+ *
+ * Tests live next to the code they test and are compiled into the
+ * shipping executable, so they would normally be scattered between
+ * hot functions, wasting instruction cache and pages.  Put CTEST_COLD
+ * in front of functions that only run under test:
+ *
+ * <pre>
+ *   CTEST_COLD void test_buffer() {
+ *       ctest_start("buffer") { ... }
+ *   }
+ * </pre>
+ *
+ * GCC and clang then optimize them for size and put them in their own
+ * section, as CTEST_SECTION does for ctest itself.  The linker groups
+ * those sections with the program's other unlikely code, away from
+ * the hot code, so a normal run never pages them in.  Other compilers
+ * ignore it.  Define CTEST_NO_SECTIONS to turn it off, which is handy
+ * for measuring the difference (see "make startup-rss").
+ */
+
+#if defined(__GNUC__) && defined(__ELF__) && !defined(CTEST_NO_SECTIONS)
+#define CTEST_SECTION __attribute__((section(".text.unlikely.ctest")))
+#define CTEST_COLD __attribute__((cold)) CTEST_SECTION
+#elif defined(__GNUC__) && !defined(CTEST_NO_SECTIONS)
+#define CTEST_SECTION
+#define CTEST_COLD __attribute__((cold))
+#else
+#define CTEST_SECTION
+#define CTEST_COLD
+#endif
+
+/** Tells the compiler which way a branch almost always goes. */
+#if defined(__GNUC__)
+#define CTEST_LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+#define CTEST_LIKELY(x) (x)
+#endif
+
 
 /** You can change ctest's run-time behavior at any time by modifying
  *  this structure.  For instance, ctest_preferences.verbosity = 4;
@@ -44,6 +88,62 @@ extern struct ctest_preferences {
 	/** Set this to 1 to print the failures.  This tells ctest to display the
          *  output of each inverted failure to ensure it looks OK. */
 	int show_failures;
+	/** If non-NULL, ctest records which source files each test's asserts
+	 *  live in and writes that index to this file when ctest_exit() is
+	 *  called.  If ::changed is also set, the index is consulted first
+	 *  so that tests which don't depend on a changed file are skipped. */
+	const char *impact_index;
+	/** Comma-separated list of source files that have changed since the
+	 *  index was written, or NULL to run every test.  ctest_read_args()
+	 *  sets ::impact_index to "ctest.impact" if --changed is given
+	 *  without --impact-index. */
+	const char *changed;
+	/** If non-NULL, a machine-readable line is written to this file as
+	 *  each test finishes.  Use ctest-merge to combine result files. */
+	const char *results;
+	/** If non-NULL, only the tests listed in this file are run, along
+	 *  with the tests nested in them and the ones that enclose them.
+	 *  The file has one test path per line, like "Parser/Numbers". */
+	const char *only;
+	/** If non-NULL, the tests listed in this file are skipped. */
+	const char *skip;
+	/** If non-NULL, statistics from previous runs are kept in this file. */
+	const char *history;
+	/** If nonzero, top-level tests are skipped when ::history says
+	 *  they're unlikely to catch a failure in this many seconds. */
+	double time_budget;
+	/** Set this to 1 to show a progress line while tests are running.
+	 *  ctest_read_args() turns this on if stdout is a terminal.
+	 *  Only shown when verbosity is 0. */
+	int progress;
+	/** Set this to 1 to run each top-level test in its own forked process
+	 *  (see ctest_fork_children()). */
+	int fork;
+	/** Set this to 1 to print how much each test grew the peak RSS and
+	 *  how many page faults it caused. */
+	int memory;
+	/** The number of times to retry a failed test.  A test that passes
+	 *  on a retry is counted as flaky instead of failed. */
+	int retries;
+	/** Set this to 1 to capture each top-level test's stdout and stderr
+	 *  and only print them if the test fails.  POSIX only. */
+	int capture;
+	/** If non-NULL, each test is recorded in this file as it starts and
+	 *  finishes, and the tests that already finished in it are skipped. */
+	const char *checkpoint;
+	/** If nonzero, tests keep going after a failed assert until this
+	 *  many have failed (see ctest_soft_asserts()). */
+	int soft_asserts;
+	/** Set this to 1 to run the tests in a child process that is
+	 *  restarted, resuming from ::checkpoint, whenever it dies.  POSIX only. */
+	int supervise;
+	/** Set this to 1 to print a unified diff when a string assert fails
+	 *  on strings that contain newlines. */
+	int diff;
+	/** If non-NULL, the stack is sampled while tests run and written
+	 *  to this file as folded stacks, each under the test's path.
+	 *  Linux on x86_64 and aarch64 only. */
+	const char *profile;
 } ctest_preferences;
 
 
@@ -93,13 +193,146 @@ struct ctest_jmp_wrapper {
 
 /* The for loop is so that ctest_internal_test_finished() called
  * when the flow of control exits the block that follows ctest_start.
+ * If an assert fails, we longjmp back to the setjmp and the for loop
+ * is entered again if the test should be retried.
  */
 #define ctest_start(name) \
-	if(setjmp(ctest_internal_start_test(name, __FILE__,__LINE__)->jmp)) { \
-		ctest_internal_finish_test(0); \
+	if(setjmp(ctest_internal_start_test(name, __FILE__,__LINE__)->jmp) && \
+		!ctest_internal_retry_test()) { \
+		/* the test failed and won't be retried */ \
 	} else for(; ctest_internal_finish_test(1); )
 
 
+/** A fixture is expensive test data that should only be built once
+ *  and shared between tests.  Declare it statically:
+ *
+ * <pre>
+ *   static struct ctest_fixture big_index = { "big index", build_index, free_index };
+ *
+ *   ctest_start("index") {
+ *       ctest_fixture_scope(&big_index);
+ *       ctest_start("lookup") {
+ *           struct index *idx = ctest_fixture(&big_index);
+ *           ...
+ *       }
+ *       ctest_start("insert") {
+ *           struct index *idx = ctest_fixture(&big_index);
+ *           ...
+ *       }
+ *   }
+ * </pre>
+ *
+ * build_index is called the first time a test calls ctest_fixture(),
+ * so if none of the tests in the scope run, it's never built.  Every
+ * test nested in the scope gets the same data, and free_index is called
+ * when the "index" test finishes, even if one of its asserts failed.
+ */
+
+struct ctest_fixture {
+	/** the name printed in messages about this fixture. */
+	const char *name;
+	/** builds the fixture and returns its data.  May fail asserts. */
+	void *(*setup)();
+	/** destroys the data returned by setup.  May be NULL. */
+	void (*teardown)(void *data);
+
+	/* The following are maintained by ctest. */
+	void *data;
+	int state;
+	void *scope;
+	struct ctest_fixture *next;
+};
+
+/** Scopes the fixture to the current test.  Nothing is built yet. */
+void ctest_fixture_scope(struct ctest_fixture *fixture);
+/** Returns the fixture's data, building it first if needed.  If the
+ *  fixture wasn't scoped, it's scoped to the current test. */
+void *ctest_fixture(struct ctest_fixture *fixture);
+
+
+/** Runs each test nested directly inside the current test in its own
+ *  forked process.  Each child gets a copy-on-write snapshot of the
+ *  parent, so build your fixtures before the nested tests start and
+ *  every test will see them in their pristine state:
+ *
+ * <pre>
+ *   ctest_start("database") {
+ *       ctest_fixture(&big_db);
+ *       ctest_fork_children();
+ *       ctest_start("delete all") { ... }
+ *       ctest_start("count") { ... }
+ *   }
+ * </pre>
+ *
+ * A child that crashes only fails its own test.  On systems without
+ * fork(), the tests are simply run in-process.
+ */
+void ctest_fork_children();
+
+
+/** Fails the current test when it finishes if it grew the process's
+ *  peak resident set size by more than kbytes.
+ */
+void ctest_memory_budget(long kbytes);
+
+
+/** Lets the current test keep going after a failed assert, so that
+ *  one run shows all of its failures instead of just the first.  The
+ *  test still fails when it finishes.  It's stopped when max asserts
+ *  have failed.  Pass 0 to stop at the first failure again.
+ *
+ * <pre>
+ *   ctest_start("records") {
+ *       ctest_soft_asserts(100);
+ *       for(i=0; i<count; i++) {
+ *           AssertStrNonEmpty(records[i].name);
+ *       }
+ *   }
+ * </pre>
+ *
+ * --soft-asserts=N does the same for every test.
+ */
+void ctest_soft_asserts(int max);
+
+/** Returns the process's resident set size in kB, or 0 if it can't be
+ *  measured.  Call it when startup is done to see how much the tests
+ *  embedded in a program cost when they're not run.
+ */
+long ctest_resident_kb();
+
+
+/** Batches asserts in tight loops.
+ *
+ * The Batch asserts in ctassert.h (BatchAssertEQ, etc) only compare
+ * their arguments and bump ::ctest_batch_passes when they pass, so they
+ * cost little more than the comparison itself.  The passes are added
+ * to ctest's counts when the batch ends or the next regular assert runs.
+ * Failures are reported immediately with their file, line and values.
+ *
+ * <pre>
+ *   ctest_batch {
+ *       for(i=0; i<10000000; i++) {
+ *           BatchAssertEQ(hash(i), expected[i]);
+ *       }
+ *   }
+ * </pre>
+ *
+ * Don't break or return out of a ctest_batch block.
+ */
+
+#define ctest_batch \
+	for(ctest_batch_open = ctest_internal_batch_begin(__FILE__, __LINE__); \
+		ctest_batch_open; ctest_batch_open = ctest_internal_batch_end())
+
+/** The number of batched asserts that have passed but haven't been counted yet. */
+extern long ctest_batch_passes;
+extern int ctest_batch_open;
+/** 1 if passing asserts may just increment ::ctest_batch_passes
+ *  instead of calling ctest_assert, otherwise 0 (the asserts in
+ *  ctassert.h & it with their result). */
+extern int ctest_fast_asserts;
+
+
 /** Indicates that an assertion has been run with the given result.
  */
 
@@ -109,11 +342,81 @@ void ctest_assert_fmt(int success, const char *file, int line, const char *msg,
 /** Flips the sense of the ensuing tests, returns true if tests will now be inverted. */
 int ctest_toggle_inversion();
 
+/** Returns a timestamp in seconds, suitable for timing intervals. */
+double ctest_now();
+
+/** The streams that ctest prints its reports to.  They're stdout and
+ *  stderr unless ::ctest_preferences.capture is set. */
+FILE* ctest_stdout();
+FILE* ctest_stderr();
+
 
 /* The following routines are not meant to be called directly; they are used
  * by the ctest_start() macro and always subject to change.
  */
 struct ctest_jmp_wrapper* ctest_internal_start_test(const char *name, const char *file, int line);
 int ctest_internal_finish_test(int success);
+int ctest_internal_retry_test();
+int ctest_internal_soft_failure();
+int ctest_internal_batch_begin(const char *file, int line);
+int ctest_internal_batch_end();
+int ctest_internal_check(int success, const char *file, int line, const char *msg);
+struct ctest_jmp_wrapper* ctest_internal_current_test();
+void ctest_internal_unwind_tests(struct ctest_jmp_wrapper *test);
+
+/** Describes an assert, packed into one string so it needs no
+ *  relocations and stays out of the way until the assert fails:
+ *      FORMAT LINE \0 X \0 OP \0 Y
+ *  X, OP and Y are the expressions and operator as written.  Y is empty
+ *  when X is compared to 0 (or NULL).  FORMAT says how to print the
+ *  values.  The file name is passed separately so all the asserts in a
+ *  file share a single copy of it.  A passing assert in ctassert.h is
+ *  a compare and a branch, and a failing one is a call to one of the
+ *  cold routines below with __FILE__ and one of these.
+ */
+#define CTEST_SITE(format,x,op,y) \
+	format CTEST_STRINGIZE(__LINE__) "\0" x "\0" op "\0" y
+#define CTEST_STRINGIZE(x) CTEST_STRINGIZE_VALUE(x)
+#define CTEST_STRINGIZE_VALUE(x) #x
+
+#define CTEST_SITE_DEC "d"
+#define CTEST_SITE_HEX "x"
+#define CTEST_SITE_FLOAT "f"
+#define CTEST_SITE_PTR "p"
+#define CTEST_SITE_STR "s"
+
+CTEST_COLD void ctest_internal_assert_long(const char *file, const char *site, int success, long x, long y);
+CTEST_COLD void ctest_internal_assert_double(const char *file, const char *site, int success, double x, double y);
+/* Not const void*: gcc would assume the pointees are read and warn that
+ * AssertPtr(&uninitialized) may use an uninitialized value. */
+CTEST_COLD void ctest_internal_assert_ptr(const char *file, const char *site, int success, void *x, void *y);
+CTEST_COLD void ctest_internal_assert_str(const char *file, const char *site, int success, const char *x, const char *y);
+CTEST_COLD void ctest_internal_assert_empty(const char *file, const char *site, const char *x);
+
+/** The longest message a failed assert prints, including the terminator. */
+#define CTEST_MESSAGE_MAX 16384
+/** Writes the message for a failed string assert to buf, which must hold
+ *  CTEST_MESSAGE_MAX bytes.  Returns the line from site.  ctest.hpp uses
+ *  this so its string asserts print the same thing. */
+CTEST_COLD int ctest_internal_string_message(char *buf, const char *file, const char *site, const char *x, const char *y);
+
+/** Set while ctbench.c runs test code on worker threads.  A passing
+ *  assert is handed to pass(), which returns true if it counted it.
+ *  Every other assert is checked between lock() and unlock(), and an
+ *  assert that fails calls fail(), which must not return, instead of
+ *  longjmping out of the test (the test's jmp_buf belongs to another
+ *  thread).
+ */
+struct ctest_internal_threads {
+	int (*pass)(void);
+	void (*lock)(void);
+	void (*unlock)(void);
+	void (*fail)(void);
+};
+extern struct ctest_internal_threads *ctest_internal_threads;
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
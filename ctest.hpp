@@ -0,0 +1,415 @@
+/* ctest.hpp
+ * The ctest contributors
+ * 19 Oct 2026
+ *
+ * Copyright (C) 2026 The ctest contributors
+ * This file is released under the MIT License.
+ * See http://www.opensource.org/licenses/mit-license.php
+ */
+
+
+/* @file ctest.hpp
+ *
+ * An optional C++ layer over ctest.  It provides the same CamelCase
+ * asserts as ctassert.h, but they deduce the types of their arguments
+ * instead of casting everything to long, double or void*, and they
+ * format their values without varargs:
+ *
+ * <pre>
+ *     std::vector<int> v;
+ *     AssertEQ(v.size(), 0u);
+ *     AssertStrEQ(name, "Bogozity");     (const char* or std::string)
+ * </pre>
+ *
+ * A passing assert is a compare and a branch.  Everything else,
+ * formatting the values included, happens out of line and only when
+ * the assert fails.
+ *
+ * ctest_start uses setjmp/longjmp, which skips destructors when an
+ * assert fails.  ctest::test runs its body with exceptions instead,
+ * so destructors run and locks are released:
+ *
+ * <pre>
+ *     ctest::test("parser", [&] {
+ *         std::lock_guard<std::mutex> lock(parser_mutex);
+ *         AssertEQ(parse("12"), 12);
+ *     });
+ * </pre>
+ *
+ * Values are printed by ctest::printer<T>.  Integers, floats, bools,
+ * chars, pointers and strings are handled, as is anything that can be
+ * written to a std::ostream.  Specialize ctest::printer to print your
+ * own types.
+ *
+ * Don't include both ctassert.h and ctest.hpp in the same file.
+ */
+
+
+#ifndef CTEST_HPP
+#define CTEST_HPP
+
+#ifdef CTEST_ASSERT_H
+#error "ctest.hpp and ctassert.h both define the Assert macros, only include one of them."
+#endif
+
+#include "ctest.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+#if defined(__GNUC__)
+#define CTEST_CPP_COLD __attribute__((cold))
+#define CTEST_NOINLINE __attribute__((noinline))
+#else
+#define CTEST_CPP_COLD
+#define CTEST_NOINLINE
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CTEST_CALLER_FILE __builtin_FILE()
+#define CTEST_CALLER_LINE __builtin_LINE()
+#else
+#define CTEST_CALLER_FILE "(c++)"
+#define CTEST_CALLER_LINE 0
+#endif
+
+
+namespace ctest {
+
+/** Thrown by a failed assert inside ctest::test.  Don't catch it. */
+struct failure {};
+
+
+namespace detail {
+
+template<class T, class = void>
+struct is_streamable : std::false_type {};
+
+template<class T>
+struct is_streamable<T, decltype(void(std::declval<std::ostream&>() << std::declval<const T&>()))>
+	: std::true_type {};
+
+template<class T>
+struct is_string : std::integral_constant<bool,
+	std::is_same<typename std::decay<T>::type, char*>::value ||
+	std::is_same<typename std::decay<T>::type, const char*>::value ||
+	std::is_same<typename std::decay<T>::type, std::string>::value> {};
+
+/** The kind of formatting a value gets.  Computed at compile time. */
+enum kind { other, boolean, character, integer, floating, pointer, string, streamable };
+
+template<class T>
+constexpr kind kind_of()
+{
+	typedef typename std::decay<T>::type D;
+	return std::is_same<D, bool>::value ? boolean :
+		std::is_same<D, char>::value ? character :
+		std::is_integral<D>::value || std::is_enum<D>::value ? integer :
+		std::is_floating_point<D>::value ? floating :
+		is_string<D>::value ? string :
+		std::is_pointer<D>::value || std::is_same<D, std::nullptr_t>::value ? pointer :
+		is_streamable<D>::value ? streamable : other;
+}
+
+template<kind K> struct format;
+
+template<> struct format<other> {
+	template<class T> static void print(std::string &out, const T&, bool) { out += "(unprintable)"; }
+};
+template<> struct format<boolean> {
+	static void print(std::string &out, bool v, bool) { out += v ? "true" : "false"; }
+};
+template<> struct format<integer> {
+	template<class T> static void print(std::string &out, const T &v, bool hex) {
+		typedef typename std::conditional<std::is_enum<T>::value,
+			std::underlying_type<T>, std::common_type<T> >::type::type I;
+		std::ostringstream os;
+		if(hex) {
+			os << "0x" << std::hex << std::uppercase;
+		}
+		/* print chars as numbers, not characters */
+		os << +static_cast<I>(v);
+		out += os.str();
+	}
+};
+template<> struct format<character> {
+	static void print(std::string &out, char v, bool hex) {
+		if(hex) {
+			format<integer>::print(out, (int)(unsigned char)v, hex);
+		} else {
+			out += '\''; out += v; out += '\'';
+		}
+	}
+};
+template<> struct format<floating> {
+	template<class T> static void print(std::string &out, const T &v, bool) {
+		/* same format as ctassert.h's %lf */
+		out += std::to_string(static_cast<double>(v));
+	}
+};
+template<> struct format<pointer> {
+	template<class T> static void print(std::string &out, const T &v, bool) {
+		std::ostringstream os;
+		os << "0x" << std::hex << std::uppercase << reinterpret_cast<std::uintptr_t>((const void*)v);
+		out += os.str();
+	}
+};
+template<> struct format<string> {
+	static void print(std::string &out, const char *v, bool) {
+		if(v) {
+			out += '"'; out += v; out += '"';
+		} else {
+			out += "NULL";
+		}
+	}
+	static void print(std::string &out, const std::string &v, bool) {
+		out += '"'; out += v; out += '"';
+	}
+};
+template<> struct format<streamable> {
+	template<class T> static void print(std::string &out, const T &v, bool) {
+		std::ostringstream os;
+		os << v;
+		out += os.str();
+	}
+};
+
+} /* namespace detail */
+
+
+/** Appends a printable version of a value to a string.
+ *  Specialize this to control how your types are printed.
+ */
+
+template<class T>
+struct printer {
+	static void print(std::string &out, const T &value, bool hex) {
+		detail::format<detail::kind_of<T>()>::print(out, value, hex);
+	}
+};
+
+
+inline int str_compare(const char *a, const char *b) { return std::strcmp(a, b); }
+inline int str_compare(const std::string &a, const char *b) { return a.compare(b); }
+inline int str_compare(const char *a, const std::string &b) { return -b.compare(a); }
+inline int str_compare(const std::string &a, const std::string &b) { return a.compare(b); }
+
+
+namespace detail {
+
+/** The innermost test started by ctest::test, so we know when to throw. */
+inline struct ctest_jmp_wrapper *&throwing_test()
+{
+	static struct ctest_jmp_wrapper *test = 0;
+	return test;
+}
+
+/** Reports a failed assert.  Inside ctest::test this throws unless the
+ *  test is collecting its failures (see ctest_soft_asserts()), elsewhere
+ *  ctest_assert longjmps out of the test or exits like always.
+ */
+
+CTEST_CPP_COLD inline void fail(const char *file, int line, const std::string &msg)
+{
+	if(throwing_test() && throwing_test() == ctest_internal_current_test()) {
+		if(ctest_internal_check(0, file, line, msg.c_str()) && !ctest_internal_soft_failure()) {
+			throw failure();
+		}
+	} else {
+		ctest_assert(0, file, line, msg.c_str());
+	}
+}
+
+inline void pass(const char *file, int line, const char *expr)
+{
+	if(CTEST_LIKELY(ctest_fast_asserts)) {
+		ctest_batch_passes += 1;
+	} else {
+		ctest_assert(1, file, line, expr);
+	}
+}
+
+/** "x op y with x=X and y=Y", the same message ctassert.h prints. */
+
+template<class X, class Y>
+CTEST_CPP_COLD CTEST_NOINLINE void fail_op(const char *file, int line, const char *xs, const char *ops,
+	const char *ys, const X &x, const Y &y, bool hex)
+{
+	std::string msg;
+	msg += xs; msg += ' '; msg += ops; msg += ' '; msg += ys;
+	msg += " with "; msg += xs; msg += '=';
+	printer<X>::print(msg, x, hex);
+	msg += " and "; msg += ys; msg += '=';
+	printer<Y>::print(msg, y, hex);
+	fail(file, line, msg);
+}
+
+/** "x op 0 with x=X" */
+
+template<class X>
+CTEST_CPP_COLD CTEST_NOINLINE void fail_zero(const char *file, int line, const char *xs, const char *ops, const X &x, bool hex)
+{
+	std::string msg;
+	msg += xs; msg += ' '; msg += ops; msg += " 0 with "; msg += xs; msg += '=';
+	printer<X>::print(msg, x, hex);
+	fail(file, line, msg);
+}
+
+inline const char *c_str(const char *s) { return s; }
+inline const char *c_str(const std::string &s) { return s.c_str(); }
+
+/** Failed string asserts print the same bounded message as ctassert.h. */
+
+template<class X, class Y>
+CTEST_CPP_COLD CTEST_NOINLINE void fail_str(const char *file, const char *site, const X &x, const Y &y)
+{
+	std::vector<char> buf(CTEST_MESSAGE_MAX);
+	int line = ctest_internal_string_message(&buf[0], file, site, c_str(x), c_str(y));
+	fail(file, line, &buf[0]);
+}
+
+CTEST_CPP_COLD inline void fail_expr(const char *file, int line, const char *expr)
+{
+	fail(file, line, expr);
+}
+
+} /* namespace detail */
+
+
+/** Runs body as a test.  Failed asserts throw ctest::failure, which
+ *  unwinds the body normally so destructors run.  Asserts in C code
+ *  called by body still longjmp, skipping destructors.
+ */
+
+template<class F>
+void test(const char *name, F &&body, const char *file = CTEST_CALLER_FILE, int line = CTEST_CALLER_LINE)
+{
+	struct ctest_jmp_wrapper *jmp = ctest_internal_start_test(name, file, line);
+	struct ctest_jmp_wrapper *outer = detail::throwing_test();
+	volatile int success = 1;
+
+	if(setjmp(jmp->jmp)) {
+		/* a C assert failed */
+		detail::throwing_test() = outer;
+		if(!ctest_internal_retry_test()) {
+			return;
+		}
+		success = 1;
+	}
+
+	while(ctest_internal_finish_test(success)) {
+		success = 1;
+		detail::throwing_test() = jmp;
+		try {
+			body();
+		} catch(const failure&) {
+			success = 0;
+		} catch(...) {
+			/* it may have come out of tests started inside body with ctest_start */
+			ctest_internal_unwind_tests(jmp);
+			detail::throwing_test() = outer;
+			ctest_internal_check(0, file, line, "test threw an unexpected exception");
+			success = 0;
+		}
+		detail::throwing_test() = outer;
+	}
+}
+
+} /* namespace ctest */
+
+
+/*
+ *      Use these macros to test your app.
+ */
+
+#define Assert(x) do { if(CTEST_LIKELY(x)) ::ctest::detail::pass(__FILE__, __LINE__, #x); \
+	else ::ctest::detail::fail_expr(__FILE__, __LINE__, #x); } while(0)
+
+#define AssertEQ(x,y) CTEST_CPP_OP(x,==,y,false)
+#define AssertNE(x,y) CTEST_CPP_OP(x,!=,y,false)
+#define AssertGT(x,y) CTEST_CPP_OP(x,>,y,false)
+#define AssertGE(x,y) CTEST_CPP_OP(x,>=,y,false)
+#define AssertLT(x,y) CTEST_CPP_OP(x,<,y,false)
+#define AssertLE(x,y) CTEST_CPP_OP(x,<=,y,false)
+
+#define AssertZero(x) CTEST_CPP_ZERO(x,==,false)
+#define AssertNonzero(x) CTEST_CPP_ZERO(x,!=,false)
+#define AssertNonZero(x) AssertNonzero(x)
+#define AssertPositive(x) CTEST_CPP_ZERO(x,>,false)
+#define AssertNegative(x) CTEST_CPP_ZERO(x,<,false)
+#define AssertNonNegative(x) CTEST_CPP_ZERO(x,>=,false)
+#define AssertNonPositive(x) CTEST_CPP_ZERO(x,<=,false)
+
+#define AssertHexEQ(x,y) CTEST_CPP_OP(x,==,y,true)
+#define AssertHexNE(x,y) CTEST_CPP_OP(x,!=,y,true)
+#define AssertHexGT(x,y) CTEST_CPP_OP(x,>,y,true)
+#define AssertHexGE(x,y) CTEST_CPP_OP(x,>=,y,true)
+#define AssertHexLT(x,y) CTEST_CPP_OP(x,<,y,true)
+#define AssertHexLE(x,y) CTEST_CPP_OP(x,<=,y,true)
+
+#define AssertPtr(p) CTEST_CPP_OP(p,!=,nullptr,false)
+#define AssertNonNull(p) AssertPtr(p)
+#define AssertNull(p) CTEST_CPP_OP(p,==,nullptr,false)
+
+/* Types are deduced, so these are the same as the plain versions. */
+#define AssertPtrEQ(x,y) AssertEQ(x,y)
+#define AssertPtrNE(x,y) AssertNE(x,y)
+#define AssertFloatEQ(x,y) AssertEQ(x,y)
+#define AssertFloatNE(x,y) AssertNE(x,y)
+#define AssertFloatGT(x,y) AssertGT(x,y)
+#define AssertFloatGE(x,y) AssertGE(x,y)
+#define AssertFloatLT(x,y) AssertLT(x,y)
+#define AssertFloatLE(x,y) AssertLE(x,y)
+#define AssertDoubleEQ(x,y) AssertEQ(x,y)
+#define AssertDoubleNE(x,y) AssertNE(x,y)
+
+/* Strings: const char* or std::string, compared by value. */
+#define AssertStrEQ(x,y) CTEST_CPP_STR(x,eq,==,y)
+#define AssertStrNE(x,y) CTEST_CPP_STR(x,ne,!=,y)
+#define AssertStrGT(x,y) CTEST_CPP_STR(x,gt,>,y)
+#define AssertStrGE(x,y) CTEST_CPP_STR(x,ge,>=,y)
+#define AssertStrLT(x,y) CTEST_CPP_STR(x,lt,<,y)
+#define AssertStrLE(x,y) CTEST_CPP_STR(x,le,<=,y)
+
+#define AssertEqual(x,y) AssertEQ(x,y)
+#define AssertNotEqual(x,y) AssertNE(x,y)
+#define AssertGreaterThan(x,y) AssertGT(x,y)
+#define AssertLessThan(x,y) AssertLT(x,y)
+#define AssertGreaterThanOrEqual(x,y) AssertGE(x,y)
+#define AssertLessThanOrEqual(x,y) AssertLE(x,y)
+#define AssertStringEqual(x,y) AssertStrEQ(x,y)
+#define AssertStringNotEqual(x,y) AssertStrNE(x,y)
+
+
+/*
+ * helper macros, not intended to be called directly.
+ */
+
+#define CTEST_CPP_OP(x,op,y,hex) do { \
+	const auto &ctest_xv = (x); const auto &ctest_yv = (y); \
+	if(CTEST_LIKELY(ctest_xv op ctest_yv)) ::ctest::detail::pass(__FILE__, __LINE__, #x " " #op " " #y); \
+	else ::ctest::detail::fail_op(__FILE__, __LINE__, #x, #op, #y, ctest_xv, ctest_yv, hex); \
+	} while(0)
+
+#define CTEST_CPP_ZERO(x,op,hex) do { \
+	const auto &ctest_xv = (x); \
+	if(CTEST_LIKELY(ctest_xv op 0)) ::ctest::detail::pass(__FILE__, __LINE__, #x " " #op " 0"); \
+	else ::ctest::detail::fail_zero(__FILE__, __LINE__, #x, #op, ctest_xv, hex); \
+	} while(0)
+
+#define CTEST_CPP_STR(x,opn,op,y) do { \
+	const auto &ctest_xv = (x); const auto &ctest_yv = (y); \
+	if(CTEST_LIKELY(::ctest::str_compare(ctest_xv, ctest_yv) op 0)) \
+		::ctest::detail::pass(__FILE__, __LINE__, #x " " #opn " " #y); \
+	else ::ctest::detail::fail_str(__FILE__, CTEST_SITE(CTEST_SITE_STR, #x, #opn, #y), ctest_xv, ctest_yv); \
+	} while(0)
+
+
+#endif
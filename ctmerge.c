@@ -0,0 +1,338 @@
+/* ctmerge.c
+ * The ctest contributors
+ * 19 Oct 2026
+ *
+ * ctest-merge: combines the result files written by ctest --results=FILE
+ * into a single summary, exit code, and list of the slowest tests.
+ *
+ * Copyright (C) 2026 The ctest contributors
+ * This file is released under the MIT License.
+ * See http://www.opensource.org/licenses/mit-license.php
+ */
+
+/* @file ctmerge.c
+ *
+ * Usage: ctest-merge [-n COUNT] FILE...
+ *
+ * If a FILE is "-", the names of the result files are read from stdin,
+ * one per line.  That way you can merge more files than will fit on
+ * the command line:
+ *
+ * <pre>
+ *     find results -name '*.ctest' | ctest-merge -
+ * </pre>
+ *
+ * Result files are read a line at a time and only the COUNT slowest
+ * tests (default 10) are kept in memory, so merging thousands of files
+ * is quick and cheap.
+ *
+ * The exit code follows ctest_exit(): the number of failed tests, up to
+ * 100.  A result file without a summary line came from a process that
+ * died before calling ctest_exit(), so it counts as a failure too.
+ * Lines that are too long to read or have no newline, like the last
+ * line of a process that died while writing it, are ignored with a
+ * warning.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static struct {
+	/** The number of result files that were read. */
+	int files;
+	/** The number of result files that had no summary line. */
+	int incomplete;
+	int tests_run;
+	int test_successes;
+	int test_failures;
+	int assertions_run;
+	int tests_skipped;
+	int tests_flaky;
+} totals;
+
+
+/** One of the slowest tests seen so far. */
+struct slow_test {
+	double seconds;
+	/** "path (file:line)", malloced. */
+	char *name;
+};
+
+/** A min-heap of the slowest tests: slowest[0] is the fastest of them. */
+static struct slow_test *slowest;
+static int slowest_count;
+static int slowest_size = 10;
+
+
+static void heap_swap(int a, int b)
+{
+	struct slow_test tmp = slowest[a];
+	slowest[a] = slowest[b];
+	slowest[b] = tmp;
+}
+
+
+static void heap_sift_down(int i)
+{
+	int child;
+
+	while((child = 2*i + 1) < slowest_count) {
+		if(child+1 < slowest_count && slowest[child+1].seconds < slowest[child].seconds) {
+			child += 1;
+		}
+		if(slowest[i].seconds <= slowest[child].seconds) {
+			break;
+		}
+		heap_swap(i, child);
+		i = child;
+	}
+}
+
+
+static char *make_name(const char *path, const char *location)
+{
+	char *name = malloc(strlen(path) + strlen(location) + 4);
+	if(!name) {
+		fprintf(stderr, "ctest-merge: out of memory!\n");
+		exit(239);
+	}
+	sprintf(name, "%s (%s)", path, location);
+	return name;
+}
+
+
+static void note_test_time(double seconds, const char *path, const char *location)
+{
+	int i;
+
+	if(slowest_size <= 0) {
+		return;
+	}
+
+	if(slowest_count < slowest_size) {
+		i = slowest_count++;
+		slowest[i].seconds = seconds;
+		slowest[i].name = make_name(path, location);
+		/* sift up */
+		while(i > 0 && slowest[(i-1)/2].seconds > slowest[i].seconds) {
+			heap_swap(i, (i-1)/2);
+			i = (i-1)/2;
+		}
+	} else if(seconds > slowest[0].seconds) {
+		free(slowest[0].name);
+		slowest[0].seconds = seconds;
+		slowest[0].name = make_name(path, location);
+		heap_sift_down(0);
+	}
+}
+
+
+/** Splits line into at most max tab-separated fields.  Returns the number of fields. */
+
+static int split_fields(char *line, char **fields, int max)
+{
+	int count = 0;
+
+	while(count < max) {
+		fields[count++] = line;
+		line = strchr(line, '\t');
+		if(!line) {
+			break;
+		}
+		*line++ = '\0';
+	}
+
+	return count;
+}
+
+
+static void merge_file(const char *filename)
+{
+	FILE *fp;
+	char line[BUFSIZ];
+	char *fields[7];
+	int count, len, lineno = 0;
+	int truncated = 0, was_truncated;
+	int have_summary = 0;
+	int tests_run = 0, test_successes = 0, test_failures = 0, tests_skipped = 0, tests_flaky = 0;
+
+	fp = fopen(filename, "r");
+	if(!fp) {
+		fprintf(stderr, "ctest-merge: could not open %s!\n", filename);
+		totals.incomplete += 1;
+		return;
+	}
+
+	totals.files += 1;
+	while(fgets(line, sizeof(line), fp)) {
+		was_truncated = truncated;
+		len = strlen(line);
+		truncated = !(len > 0 && line[len-1] == '\n');
+		if(!truncated) {
+			line[len-1] = '\0';
+		}
+		if(was_truncated) {
+			/* rest of a line that was rejected, ignore it */
+			continue;
+		}
+		lineno += 1;
+		if(truncated) {
+			/* too long for the buffer, or cut off by a process that died mid-write */
+			fprintf(stderr, "ctest-merge: %s:%d: line is too long or has no newline, ignoring it!\n",
+				filename, lineno);
+			continue;
+		}
+
+		count = split_fields(line, fields, 7);
+		if(strcmp(fields[0], "test") == 0 && count >= 5) {
+			if(strcmp(fields[1], "skip") == 0) {
+				tests_skipped += 1;
+				continue;
+			}
+			tests_run += 1;
+			if(strcmp(fields[1], "ok") == 0) {
+				test_successes += 1;
+			} else if(strcmp(fields[1], "flaky") == 0) {
+				tests_flaky += 1;
+			} else {
+				test_failures += 1;
+			}
+			note_test_time(atof(fields[2]), fields[4], fields[3]);
+		} else if(strcmp(fields[0], "summary") == 0 && count >= 6) {
+			have_summary = 1;
+			totals.tests_run += atoi(fields[1]);
+			totals.test_successes += atoi(fields[2]);
+			totals.test_failures += atoi(fields[3]);
+			totals.assertions_run += atoi(fields[4]);
+			totals.tests_skipped += atoi(fields[5]);
+			if(count >= 7) {
+				totals.tests_flaky += atoi(fields[6]);
+			}
+		}
+	}
+
+	if(!have_summary) {
+		/* The process died before ctest_exit().  Count what it did finish. */
+		fprintf(stderr, "ctest-merge: %s has no summary, the process didn't finish!\n", filename);
+		totals.incomplete += 1;
+		totals.tests_run += tests_run;
+		totals.test_successes += test_successes;
+		totals.test_failures += test_failures;
+		totals.tests_skipped += tests_skipped;
+		totals.tests_flaky += tests_flaky;
+	}
+
+	fclose(fp);
+}
+
+
+static void merge_stdin_list()
+{
+	char filename[BUFSIZ];
+	int len;
+
+	while(fgets(filename, sizeof(filename), stdin)) {
+		len = strlen(filename);
+		if(len > 0 && filename[len-1] == '\n') {
+			filename[--len] = '\0';
+		}
+		if(len > 0) {
+			merge_file(filename);
+		}
+	}
+}
+
+
+static int compare_slow_tests(const void *a, const void *b)
+{
+	double diff = ((const struct slow_test*)b)->seconds - ((const struct slow_test*)a)->seconds;
+	return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+
+static void print_results()
+{
+	int failures = totals.test_failures + totals.incomplete;
+	int i;
+
+	printf("Merged %d result file%s.\n", totals.files, (totals.files == 1 ? "" : "s"));
+
+	if(slowest_count > 0) {
+		qsort(slowest, slowest_count, sizeof(struct slow_test), compare_slow_tests);
+		printf("Slowest tests:\n");
+		for(i=0; i<slowest_count; i++) {
+			printf("  %10.6fs  %s\n", slowest[i].seconds, slowest[i].name);
+		}
+	}
+
+	/* Same format as print_ctest_results() */
+	if(failures == 0) {
+		printf("All OK.  %d test%s run, %d successe%s (%d assertion%s).\n",
+			totals.tests_run, (totals.tests_run == 1 ? "" : "s"),
+			totals.test_successes, (totals.test_successes == 1 ? "" : "s"),
+			totals.assertions_run, (totals.assertions_run == 1 ? "" : "s"));
+	} else if(totals.test_failures) {
+		printf("ERROR: %d failure%s in %d test%s run!\n",
+			totals.test_failures, (totals.test_failures == 1 ? "" : "s"),
+			totals.tests_run, (totals.tests_run == 1 ? "" : "s"));
+		if(totals.incomplete) {
+			printf("ERROR: %d result file%s incomplete!\n",
+				totals.incomplete, (totals.incomplete == 1 ? " is" : "s are"));
+		}
+	} else {
+		/* no test failed, the processes that didn't finish are the failures */
+		printf("ERROR: %d result file%s incomplete, %d test%s run!\n",
+			totals.incomplete, (totals.incomplete == 1 ? " is" : "s are"),
+			totals.tests_run, (totals.tests_run == 1 ? "" : "s"));
+	}
+
+	if(totals.tests_flaky) {
+		printf("%d flaky test%s passed on retry.\n", totals.tests_flaky,
+			(totals.tests_flaky == 1 ? "" : "s"));
+	}
+	if(totals.tests_skipped) {
+		printf("%d test%s skipped.\n", totals.tests_skipped,
+			(totals.tests_skipped == 1 ? "" : "s"));
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	int i = 1;
+	int failures;
+
+	if(i+1 < argc && strcmp(argv[i], "-n") == 0) {
+		slowest_size = atoi(argv[i+1]);
+		i += 2;
+	}
+
+	if(i >= argc) {
+		fprintf(stderr, "Usage: ctest-merge [-n COUNT] FILE...\n"
+			"  Use - as a FILE to read result file names from stdin.\n");
+		return 2;
+	}
+
+	if(slowest_size > 0) {
+		slowest = malloc(slowest_size * sizeof(struct slow_test));
+		if(!slowest) {
+			fprintf(stderr, "ctest-merge: out of memory!\n");
+			return 239;
+		}
+	}
+
+	for(; i<argc; i++) {
+		if(strcmp(argv[i], "-") == 0) {
+			merge_stdin_list();
+		} else {
+			merge_file(argv[i]);
+		}
+	}
+
+	print_results();
+
+	failures = totals.test_failures + totals.incomplete;
+	return failures < 100 ? failures : 100;
+}
@@ -0,0 +1,356 @@
+/* ctwatch.c
+ * The ctest contributors
+ * 19 Oct 2026
+ *
+ * ctest-watch: rebuilds and reruns the tests whenever a source file
+ * changes, running the tests that failed last time first.
+ *
+ * Copyright (C) 2026 The ctest contributors
+ * This file is released under the MIT License.
+ * See http://www.opensource.org/licenses/mit-license.php
+ */
+
+/* @file ctwatch.c
+ *
+ * Usage: ctest-watch [-1] [-b BUILD] [-w DIR]... COMMAND [ARG...]
+ *
+ * <pre>
+ *     ctest-watch ./ctest
+ * </pre>
+ *
+ * Watches DIR (the current directory if no -w is given) for changes to
+ * C and C++ sources, headers and Makefiles.  After every change it runs
+ * BUILD ("make ctest" by default) and, if that succeeds, the tests.
+ * The tests that failed last time are run first with --only, then the
+ * rest with --skip, so the failure you're working on shows up within
+ * moments of saving the file.  Failures are found with --results.
+ *
+ * -1 builds and tests once without waiting for changes.
+ *
+ * ctest-watch uses inotify so it only runs on Linux.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include <sys/inotify.h>
+
+
+#define FAILED_FILE ".ctest-watch-failed"
+#define FIRST_RESULTS ".ctest-watch-first"
+#define REST_RESULTS ".ctest-watch-rest"
+
+/** How long the directory must be quiet before we rebuild, in microseconds.
+ *  Editors often write a file in several steps. */
+#define SETTLE_TIME 100000
+
+#define MAX_DIRS 32
+
+
+static const char *build_command = "make ctest";
+/** the command that runs the tests and its arguments, NULL-terminated. */
+static char **test_command;
+static int test_argc;
+
+
+/** Returns true if a change to the named file should trigger a rebuild. */
+
+static int is_source_file(const char *name)
+{
+	static const char *suffixes[] = { ".c", ".h", ".cc", ".cpp", ".hpp", NULL };
+	size_t len = strlen(name);
+	size_t slen;
+	int i;
+
+	if(strcmp(name, "Makefile") == 0 || strcmp(name, "makefile") == 0) {
+		return 1;
+	}
+	for(i=0; suffixes[i]; i++) {
+		slen = strlen(suffixes[i]);
+		if(len > slen && strcmp(name + len - slen, suffixes[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/** Runs the test command with up to two more arguments.  Returns its
+ *  wait status, or -1 if it couldn't be started. */
+
+static int run_tests(const char *arg1, const char *arg2)
+{
+	char **argv;
+	pid_t pid;
+	int i, status = -1;
+
+	argv = malloc((test_argc + 3) * sizeof(char*));
+	if(!argv) {
+		fprintf(stderr, "ctest-watch: out of memory!\n");
+		exit(239);
+	}
+	for(i=0; i<test_argc; i++) {
+		argv[i] = test_command[i];
+	}
+	argv[i++] = (char*)arg1;
+	argv[i++] = (char*)arg2;
+	argv[i] = NULL;
+
+	fflush(NULL);
+	pid = fork();
+	if(pid < 0) {
+		perror("ctest-watch: fork");
+	} else if(pid == 0) {
+		execvp(argv[0], argv);
+		fprintf(stderr, "ctest-watch: could not run %s!\n", argv[0]);
+		_exit(127);
+	} else if(waitpid(pid, &status, 0) < 0) {
+		perror("ctest-watch: waitpid");
+		status = -1;
+	}
+
+	free(argv);
+	return status;
+}
+
+
+/** Appends the paths of the tests that failed in a result file to fp.
+ *  Returns the number of failures. */
+
+static int copy_failures(const char *results, FILE *fp)
+{
+	FILE *in;
+	char line[BUFSIZ];
+	char *status, *path;
+	int count = 0;
+	size_t len;
+
+	in = fopen(results, "r");
+	if(!in) {
+		return 0;
+	}
+
+	while(fgets(line, sizeof(line), in)) {
+		len = strlen(line);
+		if(len > 0 && line[len-1] == '\n') {
+			line[len-1] = '\0';
+		}
+		/* test  STATUS  SECONDS  FILE:LINE  PATH */
+		if(strncmp(line, "test\t", 5) != 0) {
+			continue;
+		}
+		status = line + 5;
+		path = strrchr(status, '\t');
+		if(path && (strncmp(status, "fail\t", 5) == 0 || strncmp(status, "crash\t", 6) == 0)) {
+			fprintf(fp, "%s\n", path+1);
+			count += 1;
+		}
+	}
+
+	fclose(in);
+	return count;
+}
+
+
+/** Returns true if the test command ran to the end, so its results can
+ *  be trusted.  ctest exits with the number of failures, up to 100. */
+
+static int tests_finished(int status)
+{
+	if(status == -1 || (WIFEXITED(status) && WEXITSTATUS(status) == 127)) {
+		printf("ctest-watch: could not run the tests.\n");
+		return 0;
+	}
+	if(WIFSIGNALED(status)) {
+		printf("ctest-watch: the tests were killed by signal %d.\n", WTERMSIG(status));
+		return 0;
+	}
+	return 1;
+}
+
+
+static int count_lines(const char *filename)
+{
+	FILE *fp = fopen(filename, "r");
+	int c, count = 0;
+
+	if(!fp) {
+		return 0;
+	}
+	while((c = getc(fp)) != EOF) {
+		if(c == '\n') {
+			count += 1;
+		}
+	}
+	fclose(fp);
+	return count;
+}
+
+
+/** Builds, runs the tests, and remembers which ones failed.  Returns
+ *  false if the build failed or the tests didn't finish, in which case
+ *  the tests that failed last time are kept. */
+
+static int build_and_test()
+{
+	FILE *fp;
+	int failed, finished;
+
+	fflush(NULL);
+	if(system(build_command) != 0) {
+		printf("ctest-watch: build failed, waiting for changes.\n");
+		return 0;
+	}
+
+	/* a run that dies before writing its results mustn't find the last run's */
+	remove(FIRST_RESULTS);
+	remove(REST_RESULTS);
+	failed = count_lines(FAILED_FILE);
+	if(failed > 0) {
+		printf("ctest-watch: running the %d test%s that failed last time.\n",
+			failed, (failed == 1 ? "" : "s"));
+		finished = tests_finished(run_tests("--only=" FAILED_FILE, "--results=" FIRST_RESULTS));
+		if(finished) {
+			printf("ctest-watch: running the rest.\n");
+			finished = tests_finished(run_tests("--skip=" FAILED_FILE, "--results=" REST_RESULTS));
+		}
+	} else {
+		finished = tests_finished(run_tests("--results=" REST_RESULTS, NULL));
+	}
+	if(!finished) {
+		printf("ctest-watch: keeping the tests that failed last time.\n");
+		return 0;
+	}
+
+	fp = fopen(FAILED_FILE ".new", "w");
+	if(!fp) {
+		fprintf(stderr, "ctest-watch: could not write %s!\n", FAILED_FILE);
+		return 0;
+	}
+	copy_failures(FIRST_RESULTS, fp);
+	copy_failures(REST_RESULTS, fp);
+	fclose(fp);
+	rename(FAILED_FILE ".new", FAILED_FILE);
+	return 1;
+}
+
+
+/** Reads events until a source file changes.  Returns its name. */
+
+static const char* wait_for_change(int fd, char *buf, size_t size)
+{
+	struct inotify_event *event;
+	ssize_t len;
+	char *ptr;
+
+	for(;;) {
+		len = read(fd, buf, size);
+		if(len <= 0) {
+			perror("ctest-watch: read");
+			exit(1);
+		}
+		for(ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event*)ptr;
+			if(event->len && is_source_file(event->name)) {
+				return event->name;
+			}
+		}
+	}
+}
+
+
+/** Throws away events until nothing has happened for SETTLE_TIME. */
+
+static void wait_for_quiet(int fd, char *buf, size_t size)
+{
+	struct timeval timeout;
+	fd_set fds;
+
+	for(;;) {
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = SETTLE_TIME;
+		if(select(fd+1, &fds, NULL, NULL, &timeout) <= 0) {
+			return;
+		}
+		if(read(fd, buf, size) <= 0) {
+			return;
+		}
+	}
+}
+
+
+static void usage()
+{
+	fprintf(stderr, "Usage: ctest-watch [-1] [-b BUILD] [-w DIR]... COMMAND [ARG...]\n"
+		"  -1        build and test once, don't watch for changes\n"
+		"  -b BUILD  the command that rebuilds the tests (default \"make ctest\")\n"
+		"  -w DIR    watch DIR instead of the current directory\n");
+	exit(2);
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *dirs[MAX_DIRS];
+	int dir_count = 0;
+	int once = 0;
+	int i = 1, fd;
+	char buf[4096];
+	const char *name;
+
+	for(; i < argc && argv[i][0] == '-'; i++) {
+		if(strcmp(argv[i], "-1") == 0) {
+			once = 1;
+		} else if(strcmp(argv[i], "-b") == 0 && i+1 < argc) {
+			build_command = argv[++i];
+		} else if(strcmp(argv[i], "-w") == 0 && i+1 < argc && dir_count < MAX_DIRS) {
+			dirs[dir_count++] = argv[++i];
+		} else {
+			usage();
+		}
+	}
+	if(i >= argc) {
+		usage();
+	}
+	test_command = argv + i;
+	test_argc = argc - i;
+	if(dir_count == 0) {
+		dirs[dir_count++] = ".";
+	}
+
+	if(!build_and_test() && once) {
+		return 1;
+	}
+	if(once) {
+		return count_lines(FAILED_FILE) > 0;
+	}
+
+	fd = inotify_init();
+	if(fd < 0) {
+		perror("ctest-watch: inotify_init");
+		return 1;
+	}
+	for(i=0; i<dir_count; i++) {
+		if(inotify_add_watch(fd, dirs[i], IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+			fprintf(stderr, "ctest-watch: could not watch %s!\n", dirs[i]);
+			return 1;
+		}
+	}
+
+	for(;;) {
+		printf("ctest-watch: waiting for changes...\n");
+		fflush(stdout);
+		name = wait_for_change(fd, buf, sizeof(buf));
+		printf("ctest-watch: %s changed.\n", name);
+		wait_for_quiet(fd, buf, sizeof(buf));
+		build_and_test();
+	}
+}
@@ -13,7 +13,490 @@
 
 #include "ctest.h"
 #include "ctassert.h"
+#include "ctbench.h"
 #include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+
+static int fixture_value;
+
+CTEST_COLD static void *build_fixture()
+{
+	printf("building fixture\n");
+	fixture_value = 42;
+	return &fixture_value;
+}
+
+CTEST_COLD static void free_fixture(void *data)
+{
+	printf("freeing fixture with %d\n", *(int*)data);
+}
+
+static struct ctest_fixture fixture = { "demo", build_fixture, free_fixture };
+
+
+/** Ensures fixtures are built once per scope and always torn down. */
+
+CTEST_COLD static void run_fixture_tests()
+{
+	ctest_start("FixtureScope") {
+		ctest_fixture_scope(&fixture);
+		printf("scoped\n");
+		ctest_start("First") {
+			AssertEQ(*(int*)ctest_fixture(&fixture), 42);
+			*(int*)ctest_fixture(&fixture) += 1;
+		}
+		ctest_start("Second") {
+			AssertEQ(*(int*)ctest_fixture(&fixture), 43);
+			AssertEQ(1,0);
+		}
+		ctest_start("Third") {
+			AssertEQ(*(int*)ctest_fixture(&fixture), 43);
+		}
+		printf("leaving scope\n");
+	}
+
+	ctest_start("FixtureFailure") {
+		AssertPtr(ctest_fixture(&fixture));
+		AssertEQ(1,0);
+	}
+}
+
+
+/** Ensures forked tests see pristine fixtures and report back to the parent. */
+
+CTEST_COLD static void run_forked_tests()
+{
+	ctest_start("ForkChildren") {
+		ctest_fixture_scope(&fixture);
+		ctest_fixture(&fixture);
+		ctest_fork_children();
+		ctest_start("Mutate") {
+			*(int*)ctest_fixture(&fixture) += 1;
+			AssertEQ(*(int*)ctest_fixture(&fixture), 43);
+		}
+		ctest_start("Pristine") {
+			AssertEQ(*(int*)ctest_fixture(&fixture), 42);
+			ctest_start("Nested") {
+				AssertEQ(1,0);
+			}
+		}
+		ctest_start("Crash") {
+			abort();
+		}
+		AssertEQ(*(int*)ctest_fixture(&fixture), 42);
+	}
+}
+
+
+/** Ensures memory budgets fail tests that use too much memory. */
+
+CTEST_COLD static void run_memory_tests()
+{
+	char *big;
+
+	ctest_start("SmallBudget") {
+		ctest_memory_budget(1024);
+		big = malloc(32*1024*1024);
+		AssertPtr(big);
+		memset(big, 1, 32*1024*1024);
+		free(big);
+	}
+
+	ctest_start("BigBudget") {
+		ctest_memory_budget(256*1024);
+		big = malloc(1024*1024);
+		AssertPtr(big);
+		memset(big, 1, 1024*1024);
+		free(big);
+	}
+}
+
+
+/** Ensures batched asserts are counted and their failures are reported. */
+
+CTEST_COLD static void run_batch_tests()
+{
+	long i;
+
+	ctest_start("BatchPasses") {
+		ctest_batch {
+			for(i=0; i<1000000; i++) {
+				BatchAssertEQ(i, i);
+				BatchAssertGE(i, 0);
+			}
+		}
+		AssertEQ(1, 1);
+	}
+
+	ctest_start("BatchFailure") {
+		ctest_batch {
+			for(i=0; i<1000; i++) {
+				BatchAssertLT(i, 500);
+			}
+		}
+	}
+}
+
+
+static volatile long bench_sink;
+
+CTEST_COLD static void bench_work(long n)
+{
+	long i;
+	for(i=0; i<n; i++) {
+		bench_sink += i;
+	}
+}
+
+
+/** Ensures A/B comparisons notice which variant is faster. */
+
+CTEST_COLD static void run_ab_tests()
+{
+	struct ctest_ab faster = { "4x less work", 0, 2.0 };
+	struct ctest_ab slower = { "4x more work", 0, 1.0 };
+
+	ctest_start("ABFaster") {
+		ctest_ab(&faster) {
+			ctest_variant_a(&faster) { bench_work(4000); }
+			ctest_variant_b(&faster) { bench_work(1000); }
+		}
+	}
+
+	ctest_start("ABSlower") {
+		ctest_ab(&slower) {
+			ctest_variant_a(&slower) { bench_work(1000); }
+			ctest_variant_b(&slower) { bench_work(4000); }
+		}
+	}
+}
+
+
+/** Ensures performance budgets fail tests that are too slow. */
+
+CTEST_COLD static void run_budget_tests()
+{
+	struct ctest_budget generous = { "1000 adds", 1.0, 1e9 };
+	struct ctest_budget stingy = { "a million adds", 1e-9, 0, 5 };
+
+	ctest_start("WithinBudget") {
+		ctest_budget(&generous) {
+			bench_work(1000);
+		}
+		AssertFloatGT(generous.seconds, 0.0);
+	}
+
+	ctest_start("OverBudget") {
+		ctest_budget(&stingy) {
+			bench_work(1000000);
+		}
+	}
+}
+
+
+CTEST_COLD static void linear_work(void *data, long n)
+{
+	bench_work(n);
+}
+
+CTEST_COLD static void quadratic_work(void *data, long n)
+{
+	long i;
+	for(i=0; i<n; i++) {
+		bench_work(n);
+	}
+}
+
+
+/** Ensures complexity checks notice accidentally quadratic code. */
+
+CTEST_COLD static void run_complexity_tests()
+{
+	struct ctest_complexity linear = { "linear", CTEST_O_N };
+	struct ctest_complexity quadratic = { "quadratic", CTEST_O_N, 64, 2048 };
+
+	ctest_start("Linear") {
+		ctest_complexity(&linear, linear_work, NULL);
+	}
+
+	ctest_start("Quadratic") {
+		ctest_complexity(&quadratic, quadratic_work, NULL);
+	}
+}
+
+
+/** Ensures --capture only shows the output of tests that fail. */
+
+CTEST_COLD static void run_noisy_tests()
+{
+	ctest_start("QuietPass") {
+		printf("this should only be seen without --capture\n");
+		fprintf(stderr, "neither should this\n");
+		AssertEQ(1, 1);
+	}
+
+	ctest_start("NoisyFailure") {
+		printf("some output\n");
+		ctest_start("Nested") {
+			fprintf(stderr, "a nested error\n");
+			AssertEQ(1, 0);
+		}
+	}
+}
+
+
+/** Each thread counts in its own cache line. */
+static struct { long count; char pad[120]; } stress_counts[4];
+
+CTEST_COLD static void count_calls(void *data, int thread)
+{
+	stress_counts[thread].count += 1;
+	AssertGT(stress_counts[thread].count, 0);
+}
+
+CTEST_COLD static void fail_on_second_thread(void *data, int thread)
+{
+	AssertLT(thread, 1);
+}
+
+CTEST_COLD static void batch_calls(void *data, int thread)
+{
+	ctest_batch {
+		BatchAssertGE(thread, 0);
+	}
+}
+
+
+/** Ensures stress runs report their scaling and fail their tests. */
+
+CTEST_COLD static void run_stress_tests()
+{
+	struct ctest_stress scaling = { "counting", 4, 0, 0.02 };
+	struct ctest_stress slow = { "too slow", 2, 100.0, 0.02 };
+	struct ctest_stress failing = { "failing", 2, 0, 0.02 };
+	struct ctest_stress batched = { "batched", 2, 0, 0.02 };
+
+	ctest_start("StressScaling") {
+		ctest_stress(&scaling, count_calls, NULL);
+		AssertEQ(scaling.steps, 3);
+	}
+
+	ctest_start("StressSpeedup") {
+		ctest_stress(&slow, count_calls, NULL);
+	}
+
+	ctest_start("StressAssert") {
+		ctest_stress(&failing, fail_on_second_thread, NULL);
+	}
+
+	ctest_start("StressBatch") {
+		ctest_stress(&batched, batch_calls, NULL);
+	}
+}
+
+
+/** Ensures failed tests are retried and the ones that pass are flaky. */
+
+CTEST_COLD static void run_flaky_tests()
+{
+	static int attempts;
+
+	ctest_start("Flaky") {
+		attempts += 1;
+		AssertGT(attempts, 1);
+	}
+
+	ctest_start("Broken") {
+		AssertEQ(1, 0);
+	}
+
+	ctest_start("Solid") {
+		AssertEQ(1, 1);
+	}
+}
+
+
+/** Ensures soft asserts report every failure, up to their limit. */
+
+CTEST_COLD static void run_soft_tests()
+{
+	static const int records[] = { 1, 2, -3, 4, -5, 6 };
+	int i;
+
+	ctest_start("Records") {
+		ctest_soft_asserts(10);
+		for(i=0; i<6; i++) {
+			AssertPositive(records[i]);
+		}
+	}
+
+	ctest_start("Limited") {
+		ctest_soft_asserts(2);
+		for(i=0; i<6; i++) {
+			AssertEQ(i, 0);
+		}
+	}
+
+	ctest_start("Hard") {
+		AssertEQ(1, 0);
+		AssertEQ(2, 0);
+	}
+
+	ctest_start("Clean") {
+		ctest_soft_asserts(10);
+		AssertEQ(1, 1);
+	}
+}
+
+
+CTEST_COLD static void spin(double seconds)
+{
+	double end = ctest_now() + seconds;
+	while(ctest_now() < end) {
+		/* busy */
+	}
+}
+
+
+/** Runs long enough for --progress to redraw its line a few times. */
+
+CTEST_COLD static void run_long_tests()
+{
+	int i, j;
+
+	ctest_start("Steps") {
+		for(i=0; i<5; i++) {
+			ctest_start("Step") {
+				for(j=0; j<20000; j++) {
+					AssertEQ(j, j);
+				}
+				spin(0.12);
+			}
+		}
+	}
+
+	ctest_start("Batches") {
+		for(i=0; i<5; i++) {
+			ctest_batch {
+				for(j=0; j<20000; j++) {
+					BatchAssertEQ(j, j);
+				}
+			}
+			spin(0.12);
+		}
+	}
+}
+
+
+/** Tests with different costs and failure rates for --time-budget to pick from. */
+
+CTEST_COLD static void run_selection_tests()
+{
+	ctest_start("Quick") {
+		AssertEQ(1, 1);
+	}
+
+	ctest_start("Slow") {
+		spin(0.3);
+	}
+
+	ctest_start("Medium") {
+		spin(0.1);
+	}
+
+	ctest_start("Broken") {
+		spin(0.15);
+		AssertEQ(1, 0);
+	}
+}
+
+
+/** Returns a malloced string of count numbered JSON records, one per line. */
+
+CTEST_COLD static char *make_records(int count)
+{
+	char *str = malloc(count * 48 + 1);
+	char *ptr = str;
+	int i;
+
+	if(!str) {
+		return NULL;
+	}
+	*ptr = '\0';
+	for(i=0; i<count; i++) {
+		ptr += sprintf(ptr, "{ \"id\": %d, \"name\": \"record\t%d\" },\n", i, i);
+	}
+	return str;
+}
+
+
+/** Ensures failed string asserts stay readable whatever the strings' sizes. */
+
+CTEST_COLD static void run_string_tests()
+{
+	char *got = make_records(5000);
+	char *expected = make_records(5000);
+	char *ptr;
+
+	ptr = strstr(expected, "\"id\": 4321,");
+	ptr[7] = '9';
+	memcpy(strstr(expected, "\"id\": 4325,") + 14, "\"zzzzzz", 7);
+
+	ctest_start("Short") {
+		AssertStrEQ("red", "green");
+	}
+
+	ctest_start("Long") {
+		AssertStrEQ(got, expected);
+	}
+
+	ctest_start("Truncated") {
+		got[1000] = '\0';
+		AssertStrEQ(got, expected);
+	}
+
+	ctest_start("Same") {
+		AssertStrNE(expected, expected);
+	}
+
+	free(got);
+	free(expected);
+}
+
+
+/** Dies in various ways so --supervise has something to resume. */
+
+CTEST_COLD static void run_crashing_tests()
+{
+	ctest_start("Before") {
+		AssertEQ(1, 1);
+	}
+
+	ctest_start("Killed") {
+		raise(SIGTERM);
+	}
+
+	ctest_start("Outer") {
+		ctest_start("First") {
+			AssertEQ(1, 1);
+		}
+		ctest_start("Exits") {
+			exit(3);
+		}
+		ctest_start("Last") {
+			AssertEQ(1, 1);
+		}
+	}
+
+	/* outside of any test, so this exits the process */
+	AssertEQ(2, 3);
+
+	ctest_start("After") {
+		AssertEQ(1, 1);
+	}
+}
 
 
 int main(int argc, char **argv)
@@ -24,6 +507,11 @@ int main(int argc, char **argv)
 
 	/* Check for special-purpose tests */
 	for(;*argv;argv++) {
+		if(strcmp(*argv,"--startup-rss") == 0) {
+			/* act like a production run that doesn't run its tests */
+			printf("startup RSS: %ld kB\n", ctest_resident_kb());
+			return 0;
+		}
 		if(strcmp(*argv,"--fail-assert") == 0) {
 			/* intentionally fail an assert */
 			AssertEQ(1,0);
@@ -36,6 +524,81 @@ int main(int argc, char **argv)
 			ctest_exit();
 			return 0;
 		}
+		if(strcmp(*argv,"--forked-tests") == 0) {
+			run_forked_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--ab") == 0) {
+			run_ab_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--complexity") == 0) {
+			run_complexity_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--budget") == 0) {
+			run_budget_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--noisy") == 0) {
+			run_noisy_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--stress") == 0) {
+			run_stress_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--flaky") == 0) {
+			run_flaky_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--soft") == 0) {
+			run_soft_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--long") == 0) {
+			run_long_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--selection") == 0) {
+			run_selection_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--strings") == 0) {
+			run_string_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--crashing") == 0) {
+			run_crashing_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--batch") == 0) {
+			run_batch_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--memory-budget") == 0) {
+			run_memory_tests();
+			ctest_exit();
+			return 0;
+		}
+		if(strcmp(*argv,"--fixtures") == 0) {
+			run_fixture_tests();
+			ctest_exit();
+			return 0;
+		}
 	}
 
 	/* Ensure that we can hit asserts without first calling ctest_start. */
@@ -0,0 +1,162 @@
+/* main.cpp
+ * Scott Bronson
+ * 19 Oct 2026
+ *
+ * Unit tests for the C++ asserts in ctest.hpp, and a main routine
+ * so they can be run standalone.
+ *
+ * Copyright (C) 2007 Scott Bronson
+ * This file is released under the MIT License.
+ * See http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include "ctest.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+/** just a stupid little trick to potentially make the test more readable. */
+#define ctest_invert while(ctest_toggle_inversion())
+
+
+/** counts destructor calls to make sure failed tests unwind properly. */
+static int destroyed;
+
+struct guard {
+	~guard() { destroyed += 1; }
+};
+
+enum color { red, green };
+
+
+static void test_cpp_ints()
+{
+	std::vector<int> v(3);
+	unsigned char uc = 200;
+	long long big = 1LL << 40;
+
+	AssertEQ(v.size(), 3u);
+	AssertGT(big, 1LL << 39);
+	AssertEQ(uc, 200);
+	AssertEQ(green, 1);
+	AssertZero(v[0]);
+	AssertHexEQ(0xBEEF, 48879);
+
+	ctest_invert {
+		AssertEQ(v.size(), 4u);
+		AssertLT(big, 0);
+		AssertHexEQ(0xBEEF, 0xDEAD);
+		AssertNonzero(v[1]);
+		AssertEQ(uc, 'c');
+		AssertEQ('a', 'b');
+		AssertEQ(true, false);
+	}
+}
+
+
+static void test_cpp_floats()
+{
+	double d = 0.0004;
+	float f = 0.5f;
+
+	AssertEQ(d, 0.0004);
+	AssertGT(f, d);
+	ctest_invert {
+		AssertLT(f, d);
+	}
+}
+
+
+static void test_cpp_ptrs()
+{
+	int i;
+	int *p = &i, *n = nullptr;
+
+	AssertPtr(p);
+	AssertNull(n);
+	AssertEQ(p, &i);
+	ctest_invert {
+		AssertPtr(n);
+	}
+}
+
+
+static void test_cpp_strings()
+{
+	const char *a = "Bogozity";
+	std::string b = "Arclamp";
+	std::string c = "Bogozity";
+
+	AssertStrEQ(a, c);
+	AssertStrEQ(c, "Bogozity");
+	AssertStrGT(a, b);
+	AssertStrNE(b, c);
+	AssertEQ(b.size(), 7u);
+	ctest_invert {
+		AssertStrEQ(a, b);
+		AssertStrLT(c, b);
+		AssertEQ(b, c);
+	}
+}
+
+
+static void run_cpp_tests()
+{
+	ctest::test("CppInts", [] { test_cpp_ints(); });
+	ctest::test("CppFloats", [] { test_cpp_floats(); });
+	ctest::test("CppPtrs", [] { test_cpp_ptrs(); });
+	ctest::test("CppStrings", [] { test_cpp_strings(); });
+
+	ctest::test("CppNested", [] {
+		int calls = 0;
+		ctest::test("Inner", [&] {
+			calls += 1;
+			Assert(calls == 1);
+		});
+		AssertEQ(calls, 1);
+	});
+
+	/* ctest_start still works, it just won't run destructors. */
+	ctest_start("CppStart") {
+		AssertEQ(std::string("x") + "y", std::string("xy"));
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	ctest_read_args(argc, argv);
+
+	for(;*argv;argv++) {
+		if(std::strcmp(*argv,"--fail-test") == 0) {
+			/* intentionally fail a test, destructors must still run */
+			ctest::test("CppFailTest", [] {
+				guard g;
+				std::vector<int> v;
+				AssertEQ(v.size(), 1u);
+			});
+			ctest::test("CppAfterFailure", [] {
+				AssertEQ(destroyed, 1);
+			});
+			ctest_exit();
+		}
+		if(std::strcmp(*argv,"--throw") == 0) {
+			/* the exception leaves a ctest_start block without finishing it */
+			ctest::test("CppThrows", [] {
+				ctest_start("Nested") {
+					throw 42;
+				}
+			});
+			ctest::test("CppAfterThrow", [] {
+				Assert(true);
+			});
+			ctest_exit();
+		}
+	}
+
+	run_cpp_tests();
+	ctest_exit();
+	return 0;
+}